@@ -0,0 +1,157 @@
+//===- ec_bench.cpp - Mock EC benchmarks ------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Measures the control loop without root or hardware: EC handshakes against
+/// the simulated EC, full versus partial sampling, a dump_fan equivalent and
+/// the automatic duty decision. Run with `make bench`.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_backend.h"
+#include "ec_io.h"
+#include "ec_sim.h"
+#include "ec_snapshot.h"
+#include "fan_curve.h"
+
+#include <fmt/core.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clevo {
+namespace {
+using SimBackend = BasicPortIoBackend<SimulatedEc>;
+
+/// Keeps the optimizer from discarding a benchmarked result.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Times \p samples runs of \p batch calls to \p op and prints the p50, p99
+/// and mean cost of a single call.
+template <typename F>
+void bench(std::string_view name, size_t samples, size_t batch, F&& op) {
+  std::vector<double> ns(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t j = 0; j < batch; ++j) op();
+    const auto took = std::chrono::steady_clock::now() - start;
+    ns[i] = std::chrono::duration<double, std::nano>(took).count() /
+            static_cast<double>(batch);
+  }
+  double mean = 0;
+  for (double v : ns) mean += v;
+  mean /= static_cast<double>(samples);
+  std::ranges::sort(ns);
+  fmt::print(
+      "{:<36} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+      name,
+      ns[samples / 2],
+      ns[std::min(samples - 1, samples * 99 / 100)],
+      mean
+  );
+}
+
+void bench_transactions() {
+  SimulatedEc sim;
+  EcWaitStats stats;
+  uint8_t     reg = 0, value = 0;
+  bench("ec_io_read (sim)", 100'000, 1, [&] {
+    ec_io_read(sim, stats, reg++, value);
+    do_not_optimize(value);
+  });
+  bench("ec_io_do 0x99 (sim)", 100'000, 1, [&] {
+    ec_io_do(sim, stats, k::ec_fan_duty_cmd, 0x01, value++);
+  });
+}
+
+void bench_sampling() {
+  const auto  ranges = ec_single_fan_layout.ranges();
+  EcRegisters regs{};
+
+  SimBackend  sim;
+  EcWaitStats stats;
+  sim.set_wait_stats(stats);
+  bench("sample full 0x100 (sim)", 2'000, 1, [&] {
+    sim.read(0, regs);
+  });
+  bench("sample partial ranges (sim)", 20'000, 1, [&] {
+    sim.read_ranges(ranges, regs);
+  });
+
+  // debugfs cost is dominated by the kernel's per-byte EC transactions; a
+  // regular file isolates the syscall side of full versus partial reads.
+  std::string path = "/tmp/clevo_bench_XXXXXX";
+  int         fd   = mkstemp(path.data());
+  if (fd < 0) return;
+  std::array<uint8_t, k::ec_reg_size> zeros{};
+  if (write(fd, zeros.data(), zeros.size()) == ssize_t(zeros.size())) {
+    DebugfsBackend file(path);
+    if (!int(file.open())) {
+      bench("sample full 0x100 (pread file)", 100'000, 1, [&] {
+        file.read(0, regs);
+      });
+      bench("sample partial ranges (pread file)", 100'000, 1, [&] {
+        file.read_ranges(ranges, regs);
+      });
+    }
+  }
+  close(fd);
+  unlink(path.c_str());
+}
+
+void bench_dump_fan() {
+  SimBackend  sim;
+  EcWaitStats stats;
+  sim.set_wait_stats(stats);
+  EcSnapshot snap;
+  bench("dump_fan snapshot + JSON (sim)", 20'000, 1, [&] {
+    ec_read_snapshot(sim, snap);
+    auto json = format_snapshot_json(snap);
+    do_not_optimize(json.data());
+  });
+}
+
+void bench_decisions() {
+  constexpr size_t batch = 1024;
+  std::mt19937     rng(42);
+  std::uniform_int_distribution<int32_t> temp(30, 100), duty(0, 100);
+
+  std::array<std::array<int32_t, 3>, batch> inputs;
+  for (auto& in : inputs) in = {temp(rng), temp(rng), duty(rng)};
+
+  size_t i = 0;
+  bench("ec_auto_duty_adjust", 10'000, batch, [&] {
+    const auto& in = inputs[i++ % batch];
+    do_not_optimize(
+        ec_auto_duty_adjust(default_fan_curve, in[0], in[1], in[2])
+    );
+  });
+}
+} // namespace
+} // namespace clevo
+
+int main() {
+  fmt::print(
+      "{:<36} {:>10} {:>10} {:>10}\n", "benchmark (ns/op)", "p50", "p99", "mean"
+  );
+  clevo::bench_transactions();
+  clevo::bench_sampling();
+  clevo::bench_dump_fan();
+  clevo::bench_decisions();
+  return 0;
+}
@@ -0,0 +1,121 @@
+//===- ec_sim.cpp - Simulated embedded controller ---------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the simulated EC state machine.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_sim.h"
+
+namespace clevo {
+uint8_t SimulatedEc::inb(uint16_t port) {
+  if (port == k::ec_sc) {
+    poll();
+    return static_cast<uint8_t>(
+        (ibf_ ? 1u << k::ibf : 0u) | (obf_ ? 1u << k::obf : 0u)
+    );
+  }
+  if (!obf_) counters_.violations += 1;
+  obf_ = false;
+  return output_;
+}
+
+void SimulatedEc::outb(uint8_t value, uint16_t port) {
+  // A byte written while IBF is still set overwrites the previous one on
+  // real hardware; the protocol must never do it.
+  if (ibf_) counters_.violations += 1;
+  ibf_              = true;
+  ibf_busy_         = timing_.ibf_polls;
+  input_            = value;
+  input_is_command_ = port == k::ec_sc;
+  if (faulty_ && freeze(ibf_stuck_until_)) return;
+  if (!ibf_busy_) consume();
+}
+
+bool SimulatedEc::freeze(clock::time_point& until) {
+  const double draw = std::uniform_real_distribution<double>()(rng_);
+  std::chrono::microseconds max;
+  if (draw < faults_.stuck_rate) {
+    max = faults_.max_stuck;
+    counters_.stuck += 1;
+  } else if (draw < faults_.stuck_rate + faults_.delay_rate) {
+    max = faults_.max_delay;
+    counters_.delayed += 1;
+  } else {
+    return false;
+  }
+  const auto range = static_cast<uint64_t>(max.count()) + 1;
+  until = clock::now() + std::chrono::microseconds(rng_() % range);
+  return true;
+}
+
+bool SimulatedEc::still_frozen(clock::time_point& until) {
+  // Only a frozen flag costs a clock read.
+  if (!faulty_ || until == clock::time_point{}) return false;
+  if (clock::now() < until) return true;
+  until = {};
+  return false;
+}
+
+void SimulatedEc::poll() {
+  if (ibf_ && !still_frozen(ibf_stuck_until_)) {
+    if (ibf_busy_) ibf_busy_ -= 1;
+    else consume();
+  }
+  if (obf_pending_ && !still_frozen(obf_stuck_until_)) {
+    if (obf_busy_) obf_busy_ -= 1;
+    else obf_ = true, obf_pending_ = false;
+  }
+}
+
+void SimulatedEc::consume() {
+  ibf_ = false;
+  if (input_is_command_) {
+    if (state_ != State::idle || obf_ || obf_pending_) counters_.aborts += 1;
+    obf_ = obf_pending_ = false;
+    obf_stuck_until_    = {};
+    switch (input_) {
+    case k::ec_sc_read_cmd: state_ = State::read_address; break;
+    case k::ec_sc_write_cmd: state_ = State::write_address; break;
+    case k::ec_fan_duty_cmd: state_ = State::command_port; break;
+    default: state_ = State::idle, counters_.violations += 1; break;
+    }
+    return;
+  }
+
+  switch (state_) {
+  case State::idle: counters_.violations += 1; break;
+  case State::read_address:
+    output_      = regs[input_];
+    obf_busy_    = timing_.obf_polls;
+    obf_pending_ = obf_busy_ != 0 || (faulty_ && freeze(obf_stuck_until_));
+    obf_         = !obf_pending_;
+    state_       = State::idle;
+    counters_.reads += 1;
+    break;
+  case State::write_address:
+    address_ = input_;
+    state_   = State::write_value;
+    break;
+  case State::write_value:
+    regs[address_] = input_;
+    state_         = State::idle;
+    counters_.writes += 1;
+    break;
+  case State::command_port:
+    command_ = input_;
+    state_   = State::command_value;
+    break;
+  case State::command_value:
+    if (command_ == 0x01) regs[k::ec_reg_fan_duty] = input_;
+    else if (command_ == 0x02) regs[k::ec_reg_gpu_fan_duty] = input_;
+    state_ = State::idle;
+    counters_.commands += 1;
+    break;
+  }
+}
+} // namespace clevo
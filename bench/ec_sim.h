@@ -0,0 +1,115 @@
+//===- ec_sim.h - Simulated embedded controller -----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// A port accessor that emulates the EC's command/status state machine, so
+/// the real handshakes in ec_io.h can be exercised without hardware.
+///
+/// Every byte written to a port sets IBF; the EC consumes it after
+/// Timing::ibf_polls further status reads. A read command answers by setting
+/// OBF after Timing::obf_polls status reads. Protocol misuse (writing while
+/// IBF is set, reading data without OBF, data without a command) is counted
+/// as a violation.
+///
+/// Faults hold IBF set or OBF clear for a random time after a byte: a
+/// short delay that walks the wait loop through its spin, yield and sleep
+/// phases, or a freeze long enough to time out the handshake. As on a real EC
+/// a command byte restarts the state machine; dropping a half sent
+/// transaction or an unread answer that way is counted as an abort.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_BENCH_EC_SIM_H
+#define CLEVO_BENCH_EC_SIM_H
+
+#include "ec_backend.h"
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <system_error>
+
+namespace clevo {
+class SimulatedEc {
+public:
+  struct Timing {
+    uint32_t ibf_polls = 2;
+    uint32_t obf_polls = 2;
+  };
+
+  struct Faults {
+    double                    delay_rate = 0; ///< bytes answered late
+    std::chrono::microseconds max_delay{0};   ///< delay, from [0, max]
+    double                    stuck_rate = 0; ///< bytes freezing a flag
+    std::chrono::microseconds max_stuck{0};   ///< freeze, from [0, max]
+    uint64_t                  seed = 1;
+  };
+
+  struct Counters {
+    uint64_t reads      = 0;
+    uint64_t writes     = 0;
+    uint64_t commands   = 0;
+    uint64_t violations = 0;
+    uint64_t aborts     = 0;
+    uint64_t delayed    = 0;
+    uint64_t stuck      = 0;
+  };
+
+  SimulatedEc() = default;
+  explicit SimulatedEc(Timing timing) : timing_(timing) {}
+  SimulatedEc(Timing timing, Faults faults)
+      : timing_(timing), faults_(faults), rng_(faults.seed),
+        faulty_(faults.delay_rate > 0 || faults.stuck_rate > 0) {}
+
+  std::errc open() { return std::errc(); }
+
+  uint8_t inb(uint16_t port);
+  void    outb(uint8_t value, uint16_t port);
+
+  const Counters& counters() const { return counters_; }
+
+  /// Whether a flag may still be held by an earlier fault.
+  bool frozen() const {
+    return ibf_stuck_until_ != clock::time_point{} ||
+           obf_stuck_until_ != clock::time_point{};
+  }
+
+  EcRegisters regs{};
+
+private:
+  enum class State {
+    idle,
+    read_address,
+    write_address,
+    write_value,
+    command_port,
+    command_value,
+  };
+
+  using clock = std::chrono::steady_clock;
+
+  void     poll();
+  void     consume();
+  bool     freeze(clock::time_point& until);
+  bool     still_frozen(clock::time_point& until);
+
+  Timing   timing_;
+  Faults   faults_;
+  Counters counters_;
+  State    state_ = State::idle;
+
+  std::mt19937_64   rng_;
+  bool              faulty_ = false;
+  clock::time_point ibf_stuck_until_{}, obf_stuck_until_{};
+
+  bool     ibf_ = false, obf_ = false, obf_pending_ = false;
+  uint32_t ibf_busy_ = 0, obf_busy_ = 0;
+  uint8_t  input_ = 0, output_ = 0, address_ = 0, command_ = 0;
+  bool     input_is_command_ = false;
+};
+} // namespace clevo
+
+#endif // CLEVO_BENCH_EC_SIM_H
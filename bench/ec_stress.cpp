@@ -0,0 +1,449 @@
+//===- ec_stress.cpp - EC protocol stress test ------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Runs the EC handshakes millions of times against a simulated EC that
+/// delays and freezes its status flags, and the debugfs backend against a
+/// file that shrinks below 0x100 bytes. Every result is checked against a
+/// shadow of the registers, so a change to the wait loop or the batching
+/// that loses sync with the EC or gives up early fails here before it
+/// reaches hardware. Run with `make stress`, or
+/// `bin/ec_stress [ITERATIONS [SEED]]`; the exit status is 1 when a check
+/// failed.
+///
+/// Waits are timed on the wall clock, which a busy machine stretches by
+/// preempting the process. A wait counts as late only past its limit plus
+/// several timeouts of slack, and a run fails on more late waits than a
+/// small budget: preemption makes a few waits late, a wait loop that
+/// overshoots makes most of them late.
+///
+/// A last check runs the -1 worker of the clevo-dgpu profile, whose fans
+/// must each follow their own sensor and duty command index.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_backend.h"
+#include "ec_io.h"
+#include "ec_sim.h"
+#include "ec_snapshot.h"
+#include "model_profile.h"
+#include "worker.h"
+
+#include <fmt/core.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bitset>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clevo {
+namespace {
+using SimBackend = BasicPortIoBackend<SimulatedEc>;
+using clock      = std::chrono::steady_clock;
+
+/// Scheduling noise tolerated on top of the wait limits.
+constexpr auto timing_slack = 4 * k::ec_wait_timeout;
+
+/// Waits checked against their limit and those past it plus timing_slack.
+struct LateWaits {
+  uint64_t checked = 0;
+  uint64_t late    = 0;
+
+  /// More than one late wait plus \p ppm per million checked.
+  bool failed(uint64_t ppm) const {
+    return late > 1 + checked * ppm / 1'000'000;
+  }
+};
+
+/// Latencies and failures of one kind of operation.
+struct OpReport {
+  std::string_view    name;
+  std::vector<double> ns;
+  uint64_t            failures = 0;
+
+  void add(clock::duration took) {
+    ns.push_back(std::chrono::duration<double, std::nano>(took).count());
+  }
+};
+
+struct Checks {
+  uint64_t  desyncs      = 0; ///< data or registers off the shadow
+  uint64_t  violations   = 0; ///< protocol misuse seen by the simulated EC
+  uint64_t  bad_errors   = 0; ///< failures other than the expected one
+  uint64_t  early        = 0; ///< timeouts before k::ec_wait_timeout
+  uint64_t  short_counts = 0; ///< short reads miscounted by the backend
+  uint64_t  fan_mixups   = 0; ///< duties landing on the wrong fan
+  LateWaits late_timeouts;    ///< operations that timed out
+  LateWaits late_successes;   ///< operations that succeeded
+
+  /// 1% of the timeouts may be preempted. A successful operation past its
+  /// limit waited out a freeze it should have given up on, so only 10 per
+  /// million of those.
+  uint64_t total() const {
+    return desyncs + violations + bad_errors + early + short_counts +
+           fan_mixups + late_timeouts.failed(10'000) +
+           late_successes.failed(10);
+  }
+};
+
+void print_header(std::string_view title) {
+  fmt::print(
+      "\n{:<28} {:>10} {:>9} {:>9} {:>9} {:>9} {:>8}\n",
+      title,
+      "ops/s",
+      "p50 ns",
+      "p99 ns",
+      "p99.9 ns",
+      "max ns",
+      "failed"
+  );
+}
+
+void print_report(OpReport& op) {
+  if (op.ns.empty()) return;
+  double total = 0;
+  for (double v : op.ns) total += v;
+  std::ranges::sort(op.ns);
+  const auto at = [&](size_t permille) {
+    return op.ns[std::min(op.ns.size() - 1, op.ns.size() * permille / 1000)];
+  };
+  fmt::print(
+      "{:<28} {:>10.0f} {:>9.0f} {:>9.0f} {:>9.0f} {:>9.0f} {:>8}\n",
+      op.name,
+      static_cast<double>(op.ns.size()) * 1e9 / total,
+      at(500),
+      at(990),
+      at(999),
+      op.ns.back(),
+      op.failures
+  );
+}
+
+/// Drives ec_io_read, ec_io_do and batched reads through one simulated EC
+/// and keeps the registers it expects the EC to hold.
+class PortStress {
+public:
+  PortStress(SimulatedEc::Faults faults, Checks& checks)
+      : backend_(SimulatedEc({}, faults)), faults_(faults), rng_(faults.seed),
+        checks_(checks) {
+    backend_.set_wait_stats(stats_);
+    for (auto& reg : sim().regs) reg = static_cast<uint8_t>(rng_());
+    shadow_ = sim().regs;
+  }
+
+  void run(size_t iterations) {
+    const auto snapshot_ranges = ec_single_fan_layout.ranges();
+    for (size_t i = 0; i < iterations; ++i) {
+      const uint64_t pick = rng_() % 10;
+      if (pick < 4) read_one();
+      else if (pick < 7) write_one();
+      else batch_read(snapshot_ranges);
+    }
+
+    const auto& counters = sim().counters();
+    checks_.violations += counters.violations;
+    // Only a transaction abandoned on a timeout may be cut short.
+    if (counters.aborts > failures()) checks_.desyncs += 1;
+  }
+
+  void print() {
+    print_report(read_);
+    print_report(do_);
+    print_report(batch_);
+    const auto& counters = sim().counters();
+    fmt::print(
+        "{} delayed and {} frozen flags, {} wait timeouts, {} aborted "
+        "transactions\n",
+        counters.delayed,
+        counters.stuck,
+        stats_.ibf.timeouts + stats_.obf.timeouts,
+        counters.aborts
+    );
+  }
+
+private:
+  SimulatedEc& sim() { return backend_.ports(); }
+
+  uint64_t failures() const {
+    return read_.failures + do_.failures + batch_.failures;
+  }
+
+  static void count_late(
+      LateWaits& waits, clock::duration took, clock::duration limit
+  ) {
+    waits.checked += 1;
+    if (took > limit) waits.late += 1;
+  }
+
+  /// Times \p op and checks its outcome against the wait limits: a failure
+  /// must be a timeout that waited at least k::ec_wait_timeout, and no
+  /// operation may take longer than the flags it met were held, each for at
+  /// most one timeout.
+  template <typename F>
+  bool timed(OpReport& report, F&& op) {
+    const auto before = sim().counters();
+    const bool held   = sim().frozen();
+
+    const auto start = clock::now();
+    std::errc  err   = op();
+    const auto took  = clock::now() - start;
+    report.add(took);
+
+    // A flag still held from an earlier operation may hold a full timeout.
+    const auto& after   = sim().counters();
+    const auto  stuck   = int64_t(after.stuck - before.stuck + held);
+    const auto  delayed = int64_t(after.delayed - before.delayed);
+    const auto  limit = stuck * (k::ec_wait_timeout + k::ec_wait_sleep) +
+                       delayed * (faults_.max_delay + k::ec_wait_sleep) +
+                       timing_slack;
+    if (!int(err)) {
+      count_late(checks_.late_successes, took, limit);
+      resync();
+      return true;
+    }
+    report.failures += 1;
+    if (err != std::errc::timed_out) checks_.bad_errors += 1;
+    else if (took < k::ec_wait_timeout) checks_.early += 1;
+    else count_late(checks_.late_timeouts, took, limit);
+    return false;
+  }
+
+  /// Abandoned writes land once the EC thaws, which a later successful
+  /// transaction waited for, so their registers are taken from the EC.
+  void resync() {
+    for (size_t reg = 0; uncertain_.any() && reg < k::ec_reg_size; ++reg)
+      if (uncertain_.test(reg)) shadow_[reg] = sim().regs[reg];
+    uncertain_.reset();
+    if (shadow_ != sim().regs) {
+      checks_.desyncs += 1;
+      shadow_ = sim().regs;
+    }
+  }
+
+  void read_one() {
+    const auto reg   = static_cast<uint8_t>(rng_());
+    uint8_t    value = 0;
+    if (timed(read_, [&] { return ec_io_read(sim(), stats_, reg, value); }))
+      if (value != shadow_[reg]) checks_.desyncs += 1;
+  }
+
+  void write_one() {
+    const auto value = static_cast<uint8_t>(rng_());
+    uint8_t    cmd   = k::ec_sc_write_cmd;
+    uint8_t    arg   = static_cast<uint8_t>(rng_());
+    size_t     reg   = arg;
+    if (rng_() % 2) {
+      const EcFan& fan = ec_dual_fans[rng_() % ec_dual_fans.size()];
+      cmd              = k::ec_fan_duty_cmd;
+      arg              = fan.index;
+      reg              = fan.duty_reg;
+    }
+    // Record the write first; resync() compares after every success.
+    const uint8_t old = shadow_[reg];
+    shadow_[reg]      = value;
+    if (!timed(do_, [&] { return ec_io_do(sim(), stats_, cmd, arg, value); }))
+      shadow_[reg] = old, uncertain_.set(reg);
+  }
+
+  void batch_read(std::span<const EcRange> ranges) {
+    EcRegisters out{};
+    if (!timed(batch_, [&] { return backend_.read_ranges(ranges, out); }))
+      return;
+    for (const auto& r : ranges)
+      if (!std::equal(
+              out.begin() + static_cast<ptrdiff_t>(r.offset),
+              out.begin() + static_cast<ptrdiff_t>(r.offset + r.length),
+              shadow_.begin() + static_cast<ptrdiff_t>(r.offset)
+          ))
+        checks_.desyncs += 1;
+  }
+
+  SimBackend                  backend_;
+  SimulatedEc::Faults         faults_;
+  EcWaitStats                 stats_;
+  std::mt19937_64             rng_;
+  Checks&                     checks_;
+  EcRegisters                 shadow_{};
+  std::bitset<k::ec_reg_size> uncertain_;
+  OpReport                    read_{"ec_io_read", {}};
+  OpReport                    do_{"ec_io_do", {}};
+  OpReport                    batch_{"read_ranges (snapshot)", {}};
+};
+
+/// Reads random ranges through the debugfs backend from a file that is cut
+/// to a random length now and then, as ec_sys returns fewer than 0x100
+/// bytes on some firmware.
+void stress_short_reads(size_t iterations, uint64_t seed, Checks& checks) {
+  std::string path = "/tmp/clevo_stress_XXXXXX";
+  int         fd   = mkstemp(path.data());
+  if (fd < 0) {
+    fmt::print("mkstemp: {}\n", strerror(errno));
+    checks.bad_errors += 1;
+    return;
+  }
+
+  std::mt19937_64 rng(seed);
+  EcRegisters     content;
+  for (auto& reg : content) reg = static_cast<uint8_t>(rng());
+  size_t size = content.size();
+
+  DebugfsBackend file(path);
+  OpReport       read{"debugfs read", {}};
+  uint64_t       short_reads = 0;
+  if (write(fd, content.data(), size) != ssize_t(size) || int(file.open())) {
+    checks.bad_errors += 1;
+    iterations = 0;
+  }
+
+  for (size_t i = 0; i < iterations; ++i) {
+    if (i % 64 == 0) {
+      size = rng() % 2 ? content.size() : 0xC0 + rng() % 0x40;
+      if (ftruncate(fd, static_cast<off_t>(size)) != 0 ||
+          pwrite(fd, content.data(), size, 0) != ssize_t(size)) {
+        checks.bad_errors += 1;
+        break;
+      }
+    }
+
+    const size_t offset = rng() % content.size();
+    const size_t length = 1 + rng() % (content.size() - offset);
+    EcRegisters  out{};
+    const auto   start = clock::now();
+    std::errc    err   = file.read(offset, std::span(out).first(length));
+    read.add(clock::now() - start);
+
+    const bool   cut   = offset + length > size;
+    const size_t valid = cut ? (offset < size ? size - offset : 0) : length;
+    if (cut) {
+      short_reads += 1;
+      read.failures += 1;
+      if (err != std::errc::message_size) checks.bad_errors += 1;
+    } else if (int(err)) {
+      checks.bad_errors += 1;
+    }
+    if (!std::equal(
+            out.begin(),
+            out.begin() + static_cast<ptrdiff_t>(valid),
+            content.begin() + static_cast<ptrdiff_t>(offset)
+        ))
+      checks.desyncs += 1;
+  }
+  if (file.stats().short_reads != short_reads) checks.short_counts += 1;
+
+  close(fd);
+  unlink(path.c_str());
+  print_report(read);
+}
+
+/// Runs the -1 worker of the clevo-dgpu profile against a simulated EC with
+/// one hot and one cool sensor, then swaps them. Each fan must follow its own
+/// sensor: the duty command for index 0x01 lands in the CPU duty register,
+/// the one for index 0x02 in the GPU duty register.
+void check_dual_fans(Checks& checks) {
+  SimBackend                      backend{SimulatedEc()};
+  WorkerState<clevo_dgpu_profile> worker(backend, default_fan_curve);
+  const auto                      fans = clevo_dgpu_profile.layout.fans();
+  for (FanChannel& ch : worker.channels) ch.ramp.set_params({0, 0, {}});
+  fmt::print("\nclevo-dgpu worker\n");
+
+  // default_fan_curve runs 65% at 90°C and stops the fan at 50°C.
+  struct Phase {
+    uint8_t cpu_temp, gpu_temp;
+    int32_t cpu_duty, gpu_duty;
+  };
+  for (const Phase& phase : {Phase{90, 50, 65, 0}, Phase{50, 90, 0, 65}}) {
+    EcRegisters& regs        = backend.ports().regs;
+    regs[k::ec_reg_cpu_temp] = phase.cpu_temp;
+    regs[k::ec_reg_gpu_temp] = phase.gpu_temp;
+    if (int(worker.sample())) {
+      checks.bad_errors += 1;
+      return;
+    }
+    if (regs[fans[0].duty_reg] != calculate_raw_fan_duty(phase.cpu_duty) ||
+        regs[fans[1].duty_reg] != calculate_raw_fan_duty(phase.gpu_duty))
+      checks.fan_mixups += 1;
+  }
+  fmt::print(
+      "{} duty commands for {} and {}\n",
+      backend.ports().counters().commands,
+      fans[0].name,
+      fans[1].name
+  );
+}
+
+bool parse_uint(std::string_view text, uint64_t& value) {
+  auto res = std::from_chars(text.begin(), text.end(), value);
+  return res.ec == std::errc() && res.ptr == text.end();
+}
+} // namespace
+} // namespace clevo
+
+int main(int argc, char** argv) {
+  uint64_t iterations = 1'000'000, seed = 1;
+  if (argc > 3 || (argc > 1 && !clevo::parse_uint(argv[1], iterations)) ||
+      (argc > 2 && !clevo::parse_uint(argv[2], seed))) {
+    fmt::print(stderr, "usage: {} [ITERATIONS [SEED]]\n", argv[0]);
+    return 2;
+  }
+  fmt::print("{} iterations, seed {}\n", iterations, seed);
+
+  clevo::Checks              checks;
+  clevo::SimulatedEc::Faults faults;
+  faults.seed = seed;
+  clevo::print_header("port, no faults");
+  {
+    clevo::PortStress clean(faults, checks);
+    clean.run(iterations);
+    clean.print();
+  }
+
+  faults.delay_rate = 0.002;
+  faults.max_delay  = 2 * clevo::k::ec_wait_yield;
+  faults.stuck_rate = 1e-5;
+  // Freezes well past timing_slack catch a wait loop that overshoots.
+  faults.max_stuck  = 10 * clevo::k::ec_wait_timeout;
+  clevo::print_header("port, delays and frozen flags");
+  {
+    clevo::PortStress faulty(faults, checks);
+    faulty.run(iterations);
+    faulty.print();
+  }
+
+  clevo::print_header("debugfs, short reads");
+  clevo::stress_short_reads(iterations, seed, checks);
+  clevo::check_dual_fans(checks);
+
+  fmt::print(
+      "\n{} desyncs, {} protocol violations, {} unexpected errors, {} early "
+      "timeouts, {} short read counts off, {} fan duties mixed up\n",
+      checks.desyncs,
+      checks.violations,
+      checks.bad_errors,
+      checks.early,
+      checks.short_counts,
+      checks.fan_mixups
+  );
+  fmt::print(
+      "{} of {} timeouts and {} of {} successes late by over {} ms\n",
+      checks.late_timeouts.late,
+      checks.late_timeouts.checked,
+      checks.late_successes.late,
+      checks.late_successes.checked,
+      std::chrono::duration_cast<std::chrono::milliseconds>(clevo::timing_slack)
+          .count()
+  );
+  return checks.total() ? 1 : 0;
+}
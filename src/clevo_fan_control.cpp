@@ -9,321 +9,1135 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "config_file.h"
+#include "control_socket.h"
+#include "duty_ramp.h"
+#include "ec_backend.h"
+#include "ec_io.h"
+#include "ec_lock.h"
+#include "ec_snapshot.h"
+#include "ec_sys_module.h"
+#include "event_loop.h"
+#include "fan_curve.h"
+#include "fan_monitor.h"
+#include "feed_forward.h"
+#include "hwmon.h"
+#include "logger.h"
+#include "metrics.h"
+#include "model_profile.h"
+#include "pid.h"
+#include "realtime.h"
+#include "sample_ring.h"
+#include "sample_scheduler.h"
+#include "simulator.h"
+#include "trace.h"
+#include "tuner.h"
+#include "watch.h"
+#include "worker.h"
+
 #include <fmt/chrono.h>
 #include <fmt/core.h>
-#include <sys/io.h>
+#include <sys/epoll.h>
 #include <sys/syscall.h>
 
-#include <fcntl.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <charconv>
 #include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <optional>
 #include <span>
 #include <string_view>
-#include <thread>
 #include <vector>
 
+namespace clevo {
 namespace {
-namespace k {
-constexpr uint16_t ec_data        = 0x62;
-constexpr uint16_t ec_sc          = 0x66;
-constexpr uint16_t ec_sc_read_cmd = 0x80;
-
-constexpr size_t ec_reg_size        = 0x100;
-constexpr size_t ec_reg_cpu_temp    = 0x07;
-constexpr size_t ec_reg_gpu_temp    = 0xCD;
-constexpr size_t ec_reg_fan_duty    = 0xCE;
-constexpr size_t ec_reg_fan_rpms_hi = 0xD0;
-constexpr size_t ec_reg_fan_rpms_lo = 0xD1;
-
-constexpr uint8_t ibf = 0x01;
-constexpr uint8_t obf = 0x00;
-} // namespace k
-
-volatile bool global_running_flag = true;
-
-std::errc ec_init() {
-  if (auto err = ioperm(k::ec_data, 1, 1)) return std::errc(err);
-  if (auto err = ioperm(k::ec_sc, 1, 1)) return std::errc(err);
-  return std::errc(EXIT_SUCCESS);
-}
-
-std::errc
-ec_io_wait(const uint16_t port, const uint8_t flag, const uint8_t value) {
-  int repeat_count = 0;
-  while (true) {
-    uint8_t data = inb(port);
-    if (((data >> flag) & 0x1) == value) break;
-    repeat_count += 1;
-    if (repeat_count >= 100) {
-      fmt::print(
-          "wait_ec error on port {:#02x}, data={:#02x}, flag={:#02x}, "
-          "value={:#02x}\n",
-          port,
-          data,
-          flag,
-          value
-      );
-      return std::errc::timed_out;
-    }
-    std::this_thread::sleep_for(std::chrono::microseconds(1));
+std::errc dump_fan(EcBackend& backend, const EcSnapshotLayout& layout) {
+  EcSnapshot snap;
+  if (auto err = ec_read_snapshot(backend, layout, snap); int(err)) {
+    fmt::print("unable to read EC from {}\n", backend.name());
+    return err;
   }
-  return std::errc(EXIT_SUCCESS);
+  fmt::print("{}", format_snapshot_json(snap));
+  return std::errc();
 }
 
-std::errc ec_io_do(const uint8_t cmd, const uint8_t port, const uint8_t value) {
-  if (auto err = ec_io_wait(k::ec_sc, k::ibf, 0); int(err)) return err;
-  outb(cmd, k::ec_sc);
-
-  if (auto err = ec_io_wait(k::ec_sc, k::ibf, 0); int(err)) return err;
-  outb(port, k::ec_data);
-
-  if (auto err = ec_io_wait(k::ec_sc, k::ibf, 0); int(err)) return err;
-  outb(value, k::ec_data);
-
-  return ec_io_wait(k::ec_sc, k::ibf, 0);
-}
-
-uint8_t ec_io_read(const uint8_t port) {
-  ec_io_wait(k::ec_sc, k::ibf, 0);
-  outb(k::ec_sc_read_cmd, k::ec_sc);
-
-  ec_io_wait(k::ec_sc, k::ibf, 0);
-  outb(port, k::ec_data);
-
-  ec_io_wait(k::ec_sc, k::obf, 1);
-  return inb(k::ec_data);
+/// Makes sure ec_sys is loaded with write support for the debugfs backend.
+/// Failures are reported but left to the backend's open to surface.
+void load_ec_sys() {
+  EcSysModule module;
+  if (auto err = ensure_ec_sys_module(true, module); int(err))
+    fmt::print(
+        "ec_sys: not loaded, unable to load: {}\n",
+        std::make_error_code(err).message()
+    );
+  else print_ec_sys_module(module);
 }
 
-int32_t calculate_fan_duty(int32_t raw_duty) {
-  return static_cast<int32_t>(static_cast<double>(raw_duty) / 255.0 * 100.0);
-}
+/// Writes \p duty_percentage to every fan and prints the snapshot read back
+/// afterwards, warning about fans that do not report the duty just written.
+std::errc set_fan(
+    EcBackend&              backend,
+    const EcSnapshotLayout& layout,
+    int32_t                 duty_percentage
+) {
+  fmt::print("Change fan duty to {}%\n", duty_percentage);
+  for (const EcFan& fan : layout.fans())
+    if (auto err = ec_write_fan_duty(backend, fan, duty_percentage); int(err))
+      return err;
+  fmt::print("\n");
 
-int32_t calculate_fan_rpms(int32_t raw_rpm_high, int32_t raw_rpm_low) {
-  int32_t raw_rpm = (raw_rpm_high << 8) + raw_rpm_low;
-  return raw_rpm > 0 ? (2156220 / raw_rpm) : 0;
+  EcSnapshot snap;
+  if (auto err = ec_read_snapshot(backend, layout, snap); int(err)) {
+    fmt::print("unable to read EC from {}\n", backend.name());
+    return err;
+  }
+  for (size_t i = 0; i < snap.fan_count; ++i)
+    if (!same_fan_duty(
+            snap.raw[layout.fans()[i].duty_reg],
+            calculate_raw_fan_duty(duty_percentage)
+        ))
+      fmt::print(
+          "EC reports {}% for {} after the write\n",
+          snap.fans[i].duty,
+          snap.fans[i].name
+      );
+  fmt::print("{}", format_snapshot_json(snap));
+  return std::errc();
 }
 
-int32_t ec_query_cpu_temp() { return ec_io_read(k::ec_reg_cpu_temp); }
+/// Optional services of the -1 worker; empty strings disable them.
+struct WorkerConfig {
+  std::string_view                 socket_path;
+  std::string_view                 shm_name;
+  std::string_view                 record_path;
+  std::string_view                 config_path;
+  ControlSettings                  control;
+  EcBackendKind                    backend = EcBackendKind::port;
+  std::optional<FeedForwardParams> feed_forward;
+  std::optional<FusionParams>      hwmon;
+  std::optional<RealtimeParams>    realtime;
+  std::optional<FanMonitorParams>  stall;
+  std::optional<uint16_t>          metrics_port;
+  LogSink                          log_sink = LogSink::automatic;
+  bool                             stats    = false;
+};
 
-int32_t ec_query_gpu_temp() { return ec_io_read(k::ec_reg_gpu_temp); }
-
-int32_t ec_query_fan_duty() {
-  return calculate_fan_duty(ec_io_read(k::ec_reg_fan_duty));
-}
+template <const ModelProfile& Profile>
+std::errc ec_worker(EcBackend& backend, const WorkerConfig& config) {
+  EventLoop loop;
+  Timer     tick;
+  Timer     ramp_tick;
+  SignalFd  signals;
+  if (auto err = loop.open(); int(err)) return err;
+  if (auto err = tick.open(); int(err)) return err;
+  if (auto err = ramp_tick.open(); int(err)) return err;
+  if (auto err = signals.open(
+          {SIGHUP, SIGINT, SIGQUIT, SIGPIPE, SIGALRM, SIGTERM, SIGUSR1, SIGUSR2}
+      );
+      int(err))
+    return err;
 
-int32_t ec_query_fan_rpms() {
-  uint8_t raw_rpm_hi = ec_io_read(k::ec_reg_fan_rpms_hi);
-  uint8_t raw_rpm_lo = ec_io_read(k::ec_reg_fan_rpms_lo);
-  return calculate_fan_rpms(raw_rpm_hi, raw_rpm_lo);
-}
+  // The command line settings, overlaid with the config file, which may
+  // replace them between two ticks.
+  ControlSettings live        = config.control;
+  auto            read_config = [&](ControlSettings& next) {
+    ConfigFile file;
+    size_t     line = 0;
+    if (auto err = read_config_file(config.config_path, file, line);
+        int(err)) {
+      if (line)
+        logger().log(
+            LogLevel::error, "{}:{}: invalid setting", config.config_path, line
+        );
+      else
+        logger().log(
+            LogLevel::error,
+            "unable to read {}: {}",
+            config.config_path,
+            std::make_error_code(err).message()
+        );
+      return err;
+    }
+    next = config.control;
+    if (auto err = apply_config_file(file, Profile.allowed_duties, next);
+        int(err)) {
+      logger().log(
+          LogLevel::error, "{}: invalid settings", config.config_path
+      );
+      return err;
+    }
+    if (file.backend && *file.backend != config.backend)
+      logger().log(
+          LogLevel::warning,
+          "{}: backend changes need a restart",
+          config.config_path
+      );
+    return std::errc();
+  };
+  if (!config.config_path.empty())
+    if (auto err = read_config(live); int(err)) return err;
 
-std::errc ec_write_fan_duty(int32_t duty_percentage) {
-  if (duty_percentage < 0 || duty_percentage > 100) {
-    fmt::print("Wrong fan duty to write: {}\n", duty_percentage);
-    return std::errc::invalid_argument;
+  fmt::print("model profile: {}\n", Profile.name);
+  WorkerState<Profile> state(backend, live.curve);
+  for (FanChannel& ch : state.channels) {
+    if (live.pid) ch.pid.emplace(*live.pid);
+    ch.ramp    = DutyRamp(live.ramp);
+    ch.monitor = FanMonitor(config.stall.value_or(FanMonitorParams()));
   }
-  return ec_io_do(
-      0x99,
-      0x01,
-      static_cast<uint8_t>(static_cast<double>(duty_percentage) / 100.0 * 255.0)
-  );
-}
-
-void dump_fan() {
-  fmt::print("{{\n");
-  fmt::print("  \"duty\": {},\n", ec_query_fan_duty());
-  fmt::print("  \"rpms\": {},\n", ec_query_fan_rpms());
-  fmt::print("  \"cpu_temp_cels\": {},\n", ec_query_cpu_temp());
-  fmt::print("  \"gpu_temp_cels\": {},\n", ec_query_gpu_temp());
-  fmt::print("}}\n");
-}
-
-int32_t identify_duty(int32_t duty) {
-  std::array<int32_t, 7> allowed_duties = {0, 16, 30, 40, 65, 90, 100};
-  if (auto res = std::ranges::find_if(
-          allowed_duties,
-          [&](int32_t d) {
-            constexpr int32_t range     = 1;
-            int32_t           min_right = d ? d - range : d;
-            int32_t           max_right = d ? d + range : d;
-            return duty >= min_right && duty <= max_right;
-          }
+  state.stall_guard = config.stall.has_value();
+  if (config.feed_forward) {
+    const FeedForwardParams& ff = *config.feed_forward;
+    if (auto err = state.load_sensor.open(ff.source, ff.watts); int(err)) {
+      fmt::print("unable to open a load source for feed-forward\n");
+      return err;
+    }
+    state.feed_forward.emplace(ff);
+    fmt::print("feed-forward from {}\n", state.load_sensor.path());
+  }
+  if (config.hwmon) {
+    if (auto err = state.hwmon.emplace().open(); int(err)) {
+      fmt::print("no hwmon temperature sensors found\n");
+      return err;
+    }
+    state.fusion = *config.hwmon;
+    for (const auto* sensor :
+         {&state.hwmon->cpu_sensor(), &state.hwmon->gpu_sensor()})
+      if (*sensor)
+        fmt::print("hwmon: {} at {}\n", (*sensor)->name, (*sensor)->path);
+  }
+  ControlServer server(state, loop);
+  if (!config.socket_path.empty()) {
+    if (auto err = server.listen(config.socket_path); int(err)) {
+      fmt::print(
+          "unable to listen on {}: {}\n",
+          config.socket_path,
+          std::make_error_code(err).message()
       );
-      res != allowed_duties.end())
-    return *res;
-  return duty;
-}
-
-int32_t
-ec_auto_duty_adjust(int32_t cpu_temp, int32_t gpu_temp, int32_t fan_duty) {
-  const int32_t temp_max = std::max(cpu_temp, gpu_temp);
-  const int32_t duty     = identify_duty(fan_duty);
-  int32_t       new_duty = temp_max >= 85 && duty < 65  ? 65
-                         : temp_max >= 75 && duty < 40  ? 40
-                         : temp_max >= 65 && duty < 30  ? 30
-                         : temp_max >= 55 && duty < 17  ? 17
-                         : temp_max <= 50               ? 0
-                         : temp_max <= 60 && duty >= 17 ? 17
-                         : temp_max <= 70 && duty >= 30 ? 30
-                         : temp_max <= 80 && duty >= 40 ? 40
-                         : temp_max <= 85 && duty >= 65 ? 65
-                                                        : -1;
-
-  if (new_duty > fan_duty) {
-    int32_t new_duty_adj = duty + ((new_duty - fan_duty) / 2);
-    if (new_duty - new_duty_adj > 2) {
-      fmt::print("using adjusted new duty={}%\n", new_duty_adj);
-      new_duty = new_duty_adj;
+      return err;
     }
+    fmt::print("listening on {}\n", config.socket_path);
+  }
+  SampleRingWriter ring;
+  if (!config.shm_name.empty()) {
+    if (auto err = ring.open(config.shm_name); int(err)) {
+      fmt::print("unable to create shared memory {}\n", config.shm_name);
+      return err;
+    }
+    fmt::print("publishing samples to /dev/shm/{}\n", config.shm_name);
+  }
+  TraceWriter trace;
+  if (!config.record_path.empty()) {
+    if (auto err = trace.open(config.record_path, Profile.name); int(err)) {
+      fmt::print("unable to record to {}\n", config.record_path);
+      return err;
+    }
+    fmt::print("recording samples to {}\n", config.record_path);
+  }
+  Metrics       metrics;
+  MetricsServer exporter(metrics, loop);
+  metrics.fan_count = state.channels.size();
+  for (size_t i = 0; i < state.channels.size(); ++i)
+    metrics.fans[i].name = state.channels[i].fan->name;
+  if (config.metrics_port) {
+    if (auto err = exporter.listen(*config.metrics_port); int(err)) {
+      fmt::print("unable to listen on 127.0.0.1:{}\n", *config.metrics_port);
+      return err;
+    }
+    fmt::print(
+        "serving metrics on http://127.0.0.1:{}/metrics\n",
+        *config.metrics_port
+    );
   }
 
-  return new_duty;
-}
+  bool      running = true;
+  int       signum  = 0;
+  std::errc result  = std::errc();
+  loop.add(signals.fd(), EPOLLIN, [&](uint32_t) {
+    if (int sig = signals.read()) signum = sig, running = false;
+  });
 
-std::errc ec_worker() {
-  setuid(0);
-  system("modprobe ec_sys");
+  // Deadlines advance from the previous deadline rather than from the end of
+  // sampling, so ticks do not drift; missed ticks are skipped.
+  auto make_scheduler = [](const ControlSettings& settings) {
+    std::array<int32_t, 2 * FanCurve::max_points> thresholds;
+    size_t threshold_count = settings.curve.thresholds(thresholds);
+    if (settings.pid) {
+      thresholds[0]   = static_cast<int32_t>(settings.pid->setpoint);
+      thresholds[1]   = static_cast<int32_t>(settings.pid->off_below);
+      threshold_count = 2;
+    }
+    return SampleScheduler(
+        settings.min_period,
+        settings.max_period,
+        std::span(thresholds.data(), threshold_count)
+    );
+  };
+  SampleScheduler scheduler = make_scheduler(live);
 
-  int32_t cpu_temp = 0, gpu_temp = 0, fan_duty = 0, auto_duty_val = -1;
-  while (global_running_flag) {
-    int io_fd = open("/sys/kernel/debug/ec/ec0/io", O_RDONLY, 0);
-    if (io_fd < 0) {
-      fmt::print("unable to read EC from sysfs\n");
-      return std::errc(errno);
+  // A resume jumps the time spent suspended. It wakes the clock watch at
+  // once, and the next tick checks too in case the kernel does not cancel
+  // realtime timers on resume.
+  auto suspended    = suspended_time();
+  auto check_resume = [&] {
+    const auto total = suspended_time();
+    const auto slept = total - suspended;
+    suspended        = total;
+    if (slept < std::chrono::seconds(1)) return false;
+    logger().log(
+        LogLevel::notice,
+        "resumed after {:.1f} s suspended",
+        std::chrono::duration<double>(slept).count()
+    );
+    state.resume();
+    scheduler = make_scheduler(live);
+    return true;
+  };
+  auto deadline = std::chrono::steady_clock::now();
+  loop.add(tick.fd(), EPOLLIN, [&](uint32_t) {
+    tick.drain();
+    check_resume();
+    metrics.tick_jitter.add(std::chrono::steady_clock::now() - deadline);
+    if (auto err = state.sample(); int(err)) {
+      result  = err;
+      running = false;
+      return;
     }
+    ring.publish(state.to_sample());
+    server.publish(state.snap);
+    if (trace.is_open()) trace.append(state.to_trace_record());
+    if (config.metrics_port) state.store_metrics(metrics);
+
+    const auto now    = std::chrono::steady_clock::now();
+    if (state.ramping()) ramp_tick.arm_at(now + live.ramp.step);
+    const double hottest = std::max(state.cpu_input, state.gpu_input);
+    const auto   period  = scheduler.next_period(
+        static_cast<int32_t>(std::lround(hottest)), now
+    );
+    do deadline += period;
+    while (deadline <= now);
+    tick.arm_at(deadline);
+  });
+  tick.arm_at(deadline);
 
-    std::array<uint8_t, k::ec_reg_size> buf{};
-    ssize_t len = read(io_fd, buf.data(), buf.size());
-
-    switch (len) {
-    case -1:
-      return fmt::print("unable to read EC from sysfs\n"), std::errc(errno);
-    case 0x100: {
-      cpu_temp = buf[k::ec_reg_cpu_temp];
-      gpu_temp = buf[k::ec_reg_gpu_temp];
-      fan_duty = calculate_fan_duty(buf[k::ec_reg_fan_duty]);
-      break;
+  ClockWatch clock_watch;
+  if (auto err = clock_watch.open(); int(err)) return err;
+  loop.add(clock_watch.fd(), EPOLLIN, [&](uint32_t) {
+    clock_watch.rearm();
+    // Sample now rather than up to a full period late.
+    if (check_resume())
+      tick.arm_at(deadline = std::chrono::steady_clock::now());
+  });
+
+  // Intermediate ramp writes run on their own short timer between samples.
+  loop.add(ramp_tick.fd(), EPOLLIN, [&](uint32_t) {
+    ramp_tick.drain();
+    if (auto err = state.step_ramps(); int(err)) {
+      result  = err;
+      running = false;
+      return;
     }
-    default: fmt::print("wrong EC size from sysfs: {}\n", len); break;
+    if (state.ramping())
+      ramp_tick.arm_at(std::chrono::steady_clock::now() + live.ramp.step);
+  });
+
+  // A reload runs on the loop thread between two ticks, so every sample
+  // sees either the old or the new settings, and the tick deadline stays.
+  ConfigWatcher watcher;
+  if (!config.config_path.empty()) {
+    if (auto err = watcher.open(config.config_path); int(err)) {
+      fmt::print("unable to watch {}\n", config.config_path);
+      return err;
     }
+    loop.add(watcher.fd(), EPOLLIN, [&](uint32_t) {
+      ControlSettings next;
+      if (!watcher.changed() || int(read_config(next))) return;
+      state.apply_settings(next);
+      live      = next;
+      scheduler = make_scheduler(live);
+      const std::string spec = live.pid ? format_pid_params(*live.pid)
+                                        : format_fan_curve(live.curve);
+      logger().log(
+          LogLevel::notice,
+          "reloaded {}: {} {}, sampling {}-{} ms",
+          config.config_path,
+          live.pid ? "pid" : "curve",
+          spec,
+          live.min_period.count(),
+          live.max_period.count()
+      );
+    });
+    fmt::print("watching {}\n", config.config_path);
+  }
 
-    close(io_fd);
+  // Started before enter_realtime() so the writer keeps the default policy
+  // and affinity instead of inheriting SCHED_FIFO.
+  if (auto err = logger().start(config.log_sink); int(err)) {
+    fmt::print("unable to connect to the journal\n");
+    return err;
+  }
+  struct LoggerGuard {
+    ~LoggerGuard() { logger().stop(); }
+  } logger_guard;
 
-    int32_t next_duty = ec_auto_duty_adjust(cpu_temp, gpu_temp, fan_duty);
-    if ((next_duty != -1 && next_duty != auto_duty_val) ||
-        (next_duty == 0 && fan_duty != 0)) {
-      fmt::print(
-          "{:%m/%d %H:%M:%S} - CPU={}°C, GPU={}°C, auto fan duty to {}%\n",
-          std::chrono::system_clock::now(),
-          cpu_temp,
-          gpu_temp,
-          next_duty
-      );
-      ec_write_fan_duty(next_duty);
-      auto_duty_val = next_duty;
-    }
+  if (config.realtime) {
+    if (auto err = enter_realtime(*config.realtime); int(err)) return err;
+    logger().log(
+        LogLevel::info, "running SCHED_FIFO {}", config.realtime->priority
+    );
+  }
+
+  while (running)
+    if (auto err = loop.run_once(); int(err)) return err;
+  logger().stop();
 
-    std::this_thread::sleep_for(std::chrono::seconds(2));
+  if (signum) {
+    fmt::print(
+        "ec on signal: {}\n, resetting to {}%\n",
+        strsignal(signum),
+        ec_handoff_duty
+    );
+    set_fan(backend, Profile.layout, ec_handoff_duty);
+  }
+  if (config.stats) {
+    fmt::print(
+        stderr,
+        "duty writes: {} issued, {} skipped, {} EC overrides\n",
+        state.writes.issued,
+        state.writes.skipped,
+        state.writes.overrides
+    );
+    fmt::print(stderr, "log records dropped: {}\n", logger().dropped());
   }
+  if (config.stats || config.realtime) {
+    // Compare against a run without --realtime to see the timeouts it saves.
+    const EcWaitStats& waits = ec_wait_stats();
+    fmt::print(
+        stderr,
+        "EC wait timeouts: {} in {} transactions, {} errors, realtime {}\n",
+        waits.ibf.timeouts + waits.obf.timeouts,
+        backend.stats().transactions,
+        backend.stats().errors,
+        config.realtime ? "on" : "off"
+    );
+  }
+  if (int(result)) return result;
   fmt::print("worker quit\n");
   return std::errc(EXIT_SUCCESS);
 }
 
 void print_help() {
   fmt::print(R"(
-Usage: clevo-fancontrol [fan-duty-percentage|-1]
+Usage: clevo-fancontrol [options] [fan-duty-percentage|-1]
 
 Dump/Control fan duty on Clevo laptops. Display indicator by default.
 
 Arguments:
   [fan-duty-percentage|-1]  Target fan duty in percentage, from 40 to 100
+  --backend port|debugfs|mock
+                            EC transport used for every read and write
+                            (default: debugfs for -1 and --daemon, port
+                            otherwise; debugfs sets the duty through the
+                            port command)
+  --daemon                  Run the -1 worker and serve get/set/subscribe
+                            requests on a Unix socket
+  --socket PATH             Control socket path for --daemon
+                            (default: /run/clevo-fancontrol.sock)
+  --lock PATH               File every instance flock()s around each EC
+                            operation (default: /run/clevo-fancontrol.lock,
+                            port and debugfs only unless given; other paths
+                            need root). The -1 worker also holds PATH.worker
+                            while it runs, so a second one fails to start
+  --shm NAME                Publish every worker sample to the seqlock ring
+                            /dev/shm/NAME (--daemon default: clevo-fancontrol)
+  --config FILE             Read backend, curve, mode (curve|pid), pid, ramp,
+                            interval-min and interval-max from "key = value"
+                            lines of FILE, overriding the options, and reload
+                            the -1 worker whenever FILE changes
+  --record FILE             Append a 64 byte record per worker sample to the
+                            memory mapped ring FILE (64 MiB, 2^20 records)
+  --dump-trace FILE         Print the records of FILE and exit
+  --format FORMAT           Output format: csv|jsonl for --dump-trace
+                            (default: csv), json|ndjson|csv|binary for
+                            --watch (default: ndjson)
+  --watch                   Print a snapshot every --interval MS (default:
+                            1000) until interrupted, one write per sample
+  --delta                   With --watch, only print the fields that changed
+  --simulate FILE           Replay the trace FILE through --curve or --pid on
+                            an ideal EC and report duty changes, time above
+                            --above TEMP (default: 80) and fan-on time;
+                            repeat to replay several traces
+  --tune [KEY=VALUE,...]    Search mode=curve|pid candidates (2000) over the
+                            --simulate traces on threads (one per core) and
+                            print the top (5) by cost: duty * mean duty +
+                            changes * changes per hour + peak * °C of peak
+                            over limit (85) + hot * % of time over limit,
+                            weights 1, 0.5, 10 and 5; seed (1)
+  --thermal KEY=VALUE,...   Thermal model of the replays: a duty below the
+                            recorded one heats by gain (0.25) °C per % with
+                            time constant tau (60) s; gain=0 disables it.
+                            On by default only for --tune, so --simulate
+                            alone reports the recorded temperatures
+  --interval-min MS         Worker sampling period while temperatures move
+                            fast or sit near a curve threshold (default: 250)
+  --interval-max MS         Worker sampling period once temperatures are
+                            stable (default: 4000)
+  --curve T:D:H,...         Fan curve for the -1 worker: duty D% from T°C,
+                            released H°C below T, with ascending T and D
+                            (default: 55:17:5,65:30:5,75:40:5,85:65:5)
+  --pid [KEY=VALUE,...]     Drive the -1 worker with a PID controller instead
+                            of the curve. Keys: setpoint (60), off_below (50),
+                            kp (4), ki (0.2), kd (2), slew in %/s (10) and
+                            min running duty (0)
+  --model clevo|clevo-dgpu|BOARD
+                            EC register profile, by name or by a board name it
+                            lists such as pang11. clevo-dgpu adds a GPU fan
+                            following the GPU sensor while the CPU fan follows
+                            the CPU (default: from the DMI board name, else
+                            clevo)
+  --ramp KEY=VALUE,...      Ramp curve duty changes over time. Keys: up and
+                            down in %/s, 0 to jump (20, 5), and step, the
+                            period of intermediate writes in ms (200). Steps
+                            below the profile's lowest spinning duty are
+                            skipped
+  --feed-forward [KEY=VALUE,...]
+                            Raise the duty of the -1 worker to duty (40) for
+                            hold ms (10000) when the load rises by jump (0.25)
+                            to at least level (0.5) within one sample. Load is
+                            package power over watts (25) from RAPL, or busy
+                            time from /proc/stat: source=auto|rapl|stat
+  --hwmon [KEY=VALUE,...]   Feed the -1 worker millidegree k10temp/coretemp
+                            and amdgpu hwmon temperatures, combined with the
+                            EC readings by mode=max (default) or
+                            mode=weighted with weight (0.7) on hwmon
+  --realtime [KEY=VALUE,...]
+                            Run the -1 worker SCHED_FIFO at prio (1), pinned
+                            to cpu (none), with memory locked and stack KiB
+                            (256) pre-faulted; reports EC wait timeouts
+  --stall [KEY=VALUE,...]   Force a fan of the -1 worker to duty (100) after
+                            ticks (8) samples at 0 RPM with a non-zero duty.
+                            RPM is smoothed by filter=median of window (5)
+                            readings or filter=ema with alpha (0.3)
+  --metrics PORT            Serve Prometheus metrics of the -1 worker (temps,
+                            duty, rpm, EC and write counters, tick jitter and
+                            EC latency histograms) on 127.0.0.1:PORT/metrics
+  --log auto|console|journal
+                            Where the -1 worker logs: stdout, or journald
+                            with structured fields. auto picks journald when
+                            stdout is connected to it
+  --stats                   Print EC transaction latency and IBF/OBF wait
+                            histograms to stderr on exit
   -h, --help                Display this help and exit
 
 Without arguments this program will dump current fan duty and temperature in JSON
 format. The binary requires running as root - either directly or with
 setuid=root flag.
-This program would always attempt to load kernel
-module 'ec_sys', in order to query EC information from
-'/sys/kernel/debug/ec/ec0/io' instead of polling EC ports for readings,
-which may be more risky if interrupted or concurrently operated during the
-process.
+The debugfs backend loads kernel module 'ec_sys' with write_support=1, in order
+to query EC information from '/sys/kernel/debug/ec/ec0/io' instead of polling
+EC ports, which may be more risky if interrupted or concurrently operated
+during the process. It still sets the fan duty through the EC ports, as the
+duty register only reports it. The -1 worker and --daemon use it by default.
+The mock backend keeps the EC registers in memory.
+
+After a resume from suspend the -1 worker samples at once, re-asserts its duty
+and restarts ramps and PID. A system-sleep hook running as root may send "sleep"
+and "wake" to the --socket so the fans sit at 40% while the system is suspended;
+"wake" is refused unless "sleep" came first.
+
+While a --daemon serves --socket, dumping or setting the fan duty asks the
+daemon instead of touching the EC, and -1 puts the daemon back on its curve
+rather than starting a second worker. Other instances wait for the --lock file
+around each EC operation; --stats reports how long they waited. Tools that
+ignore the lock still must not touch the EC ports concurrently.
 
 DO NOT MANIPULATE OR QUERY EC I/O PORTS WHILE THIS PROGRAM IS RUNNING.
 
 )");
 }
 
-std::errc set_fan(int32_t duty_percentage) {
-  fmt::print("Change fan duty to {}%\n", duty_percentage);
-  if (auto err = ec_write_fan_duty(duty_percentage); int(err)) return err;
-  fmt::print("\n");
-  dump_fan();
-  return std::errc(EXIT_SUCCESS);
+struct Options {
+  std::optional<EcBackendKind>     backend;
+  bool                             help    = false;
+  bool                             stats   = false;
+  bool                             daemon  = false;
+  std::string_view                 socket  = ControlServer::default_path;
+  std::optional<std::string_view>  lock;
+  std::optional<std::string_view>  shm;
+  std::optional<std::string_view>  record;
+  std::optional<std::string_view>  config;
+  std::optional<std::string_view>  dump_trace;
+  std::vector<std::string_view>    traces;
+  std::optional<TuneParams>        tune;
+  std::optional<ThermalModel>      thermal;
+  int32_t                          above = 80;
+  std::optional<std::string_view>  format;
+  bool                             watch = false;
+  WatchParams                      watch_params;
+  std::chrono::milliseconds        min_period{250};
+  std::chrono::milliseconds        max_period{4000};
+  const ModelProfile*              model = nullptr;
+  std::optional<std::string_view>  curve_spec;
+  FanCurve                         curve = default_fan_curve;
+  std::optional<PidParams>         pid;
+  RampParams                       ramp;
+  std::optional<FeedForwardParams> feed_forward;
+  std::optional<FusionParams>      hwmon;
+  std::optional<RealtimeParams>    realtime;
+  std::optional<FanMonitorParams>  stall;
+  LogSink                          log_sink = LogSink::automatic;
+  std::optional<uint16_t>          metrics_port;
+  std::optional<std::string_view>  duty;
+};
+
+/// Returns the value of option \p name given either as "name=value" or as
+/// "name value", advancing \p i past a consumed separate value.
+std::optional<std::string_view> option_value(
+    std::span<std::string_view> args, size_t& i, std::string_view name
+) {
+  std::string_view arg = args[i];
+  if (!arg.starts_with(name)) return std::nullopt;
+  arg.remove_prefix(name.size());
+  if (arg.starts_with('=')) return arg.substr(1);
+  if (!arg.empty() || i + 1 >= args.size()) return std::nullopt;
+  return args[++i];
 }
 
-void ec_on_sigterm(int signum) {
-  constexpr int32_t fan_reset = 40;
+/// Returns the KEY=VALUE list of option \p name, empty when it is given
+/// without one. The list is optional, so only a separate argument that looks
+/// like one is consumed.
+std::optional<std::string_view> optional_list(
+    std::span<std::string_view> args, size_t& i, std::string_view name
+) {
+  std::string_view arg = args[i];
+  if (!arg.starts_with(name)) return std::nullopt;
+  arg.remove_prefix(name.size());
+  if (arg.starts_with('=')) return arg.substr(1);
+  if (!arg.empty()) return std::nullopt;
+  if (i + 1 < args.size() && args[i + 1].find('=') != args[i + 1].npos)
+    return args[++i];
+  return std::string_view();
+}
+
+std::error_code
+parse_period(std::string_view arg, std::chrono::milliseconds& period) {
+  int64_t ms;
+  if (auto res = std::from_chars(arg.begin(), arg.end(), ms);
+      res.ec != std::errc() || res.ptr != arg.end() || ms <= 0) {
+    fmt::print("invalid interval {}!\n", arg);
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  period = std::chrono::milliseconds(ms);
+  return {};
+}
+
+std::error_code parse_args(std::span<std::string_view> args, Options& opts) {
+  for (size_t i = 1; i < args.size(); ++i) {
+    std::string_view arg = args[i];
+    if (arg == "--help" || arg == "-h") {
+      opts.help = true;
+    } else if (arg == "--stats") {
+      opts.stats = true;
+    } else if (arg == "--daemon") {
+      opts.daemon = true;
+    } else if (auto path = option_value(args, i, "--socket")) {
+      opts.socket = *path;
+    } else if (auto lock_path = option_value(args, i, "--lock")) {
+      opts.lock = *lock_path;
+    } else if (auto name = option_value(args, i, "--shm")) {
+      opts.shm = *name;
+    } else if (auto config = option_value(args, i, "--config")) {
+      opts.config = *config;
+    } else if (auto record = option_value(args, i, "--record")) {
+      opts.record = *record;
+    } else if (auto trace = option_value(args, i, "--dump-trace")) {
+      opts.dump_trace = *trace;
+    } else if (auto sim = option_value(args, i, "--simulate")) {
+      opts.traces.push_back(*sim);
+    } else if (auto thermal = option_value(args, i, "--thermal")) {
+      ThermalModel model = opts.thermal.value_or(default_thermal_model);
+      if (int(parse_thermal_model(*thermal, model))) {
+        fmt::print("invalid thermal model {}!\n", *thermal);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+      opts.thermal = model;
+    } else if (auto tune_spec = optional_list(args, i, "--tune")) {
+      if (int(parse_tune_params(*tune_spec, opts.tune.emplace()))) {
+        fmt::print("invalid tune parameters {}!\n", *tune_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto above = option_value(args, i, "--above")) {
+      auto res = std::from_chars(above->begin(), above->end(), opts.above);
+      if (res.ec != std::errc() || res.ptr != above->end()) {
+        fmt::print("invalid temperature {}!\n", *above);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto format_name = option_value(args, i, "--format")) {
+      // Checked against --dump-trace or --watch once every option is in.
+      opts.format = *format_name;
+    } else if (arg == "--watch") {
+      opts.watch = true;
+    } else if (arg == "--delta") {
+      opts.watch_params.delta = true;
+    } else if (auto watch_ms = option_value(args, i, "--interval")) {
+      if (auto err = parse_period(*watch_ms, opts.watch_params.interval))
+        return err;
+    } else if (auto min_ms = option_value(args, i, "--interval-min")) {
+      if (auto err = parse_period(*min_ms, opts.min_period)) return err;
+    } else if (auto max_ms = option_value(args, i, "--interval-max")) {
+      if (auto err = parse_period(*max_ms, opts.max_period)) return err;
+    } else if (auto spec = option_value(args, i, "--curve")) {
+      opts.curve_spec = *spec;
+    } else if (auto pid_spec = optional_list(args, i, "--pid")) {
+      if (int(parse_pid_params(*pid_spec, opts.pid.emplace()))) {
+        fmt::print("invalid PID parameters {}!\n", *pid_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto rt_spec = optional_list(args, i, "--realtime")) {
+      if (int(parse_realtime_params(*rt_spec, opts.realtime.emplace()))) {
+        fmt::print("invalid realtime parameters {}!\n", *rt_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto stall_spec = optional_list(args, i, "--stall")) {
+      if (int(parse_fan_monitor_params(*stall_spec, opts.stall.emplace()))) {
+        fmt::print("invalid stall parameters {}!\n", *stall_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto hwmon_spec = optional_list(args, i, "--hwmon")) {
+      if (int(parse_fusion_params(*hwmon_spec, opts.hwmon.emplace()))) {
+        fmt::print("invalid hwmon parameters {}!\n", *hwmon_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto ff_spec = optional_list(args, i, "--feed-forward")) {
+      if (int(parse_feed_forward_params(
+              *ff_spec, opts.feed_forward.emplace()
+          ))) {
+        fmt::print("invalid feed-forward parameters {}!\n", *ff_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto ramp_spec = option_value(args, i, "--ramp")) {
+      if (int(parse_ramp_params(*ramp_spec, opts.ramp))) {
+        fmt::print("invalid ramp parameters {}!\n", *ramp_spec);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto model = option_value(args, i, "--model")) {
+      if (!(opts.model = find_model_profile(*model))) {
+        fmt::print("invalid model {}!\n", *model);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+    } else if (auto port = option_value(args, i, "--metrics")) {
+      uint16_t value;
+      auto     res = std::from_chars(port->begin(), port->end(), value);
+      if (res.ec != std::errc() || res.ptr != port->end() || !value) {
+        fmt::print("invalid metrics port {}!\n", *port);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+      opts.metrics_port = value;
+    } else if (auto sink = option_value(args, i, "--log")) {
+      auto log_sink = parse_log_sink(*sink);
+      if (!log_sink) {
+        fmt::print("invalid log sink {}!\n", *sink);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+      opts.log_sink = *log_sink;
+    } else if (auto v = option_value(args, i, "--backend")) {
+      auto kind = parse_ec_backend_kind(*v);
+      if (!kind) {
+        fmt::print("invalid backend {}!\n", *v);
+        return std::make_error_code(std::errc::invalid_argument);
+      }
+      opts.backend = *kind;
+    } else if (!opts.duty) {
+      opts.duty = arg;
+    } else {
+      fmt::print("unexpected argument {}!\n", arg);
+      return std::make_error_code(std::errc::invalid_argument);
+    }
+  }
+  return {};
+}
+
+/// Picks the profile from the DMI board name unless --model chose one, then
+/// builds the curve against the duty steps of that profile.
+std::error_code resolve_model(Options& opts) {
+  if (!opts.model) {
+    std::string board;
+    opts.model = detect_model_profile(board);
+    if (!opts.model) {
+      opts.model = &clevo_profile;
+      fmt::print(
+          stderr,
+          "unknown board '{}', using the {} profile\n",
+          board,
+          opts.model->name
+      );
+    }
+  }
+  opts.curve = opts.model->default_curve;
+  if (opts.curve_spec &&
+      int(parse_fan_curve(
+          *opts.curve_spec, opts.curve, opts.model->allowed_duties
+      ))) {
+    fmt::print("invalid fan curve {}!\n", *opts.curve_spec);
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  return {};
+}
+
+void print_sim_result(
+    std::string_view name, const SimResult& r, int32_t threshold
+) {
+  const double span = std::max(r.duration, 1e-9);
   fmt::print(
-      "ec on signal: {}\n, resetting to {}%\n", strsignal(signum), fan_reset
+      "{}: {} duty changes, {:.1f} min above {}°C, peak {}°C, fan on "
+      "{:.1f} h ({:.0f}%), mean duty {:.1f}%\n",
+      name,
+      r.duty_changes,
+      r.time_above / 60.0,
+      threshold,
+      r.peak_temp,
+      r.fan_on / 3600.0,
+      100.0 * r.fan_on / span,
+      r.duty_seconds / span
   );
-  global_running_flag = false;
-  set_fan(fan_reset);
 }
 
-void install_signal_handler() {
-  std::signal(SIGHUP, ec_on_sigterm);
-  std::signal(SIGINT, ec_on_sigterm);
-  std::signal(SIGQUIT, ec_on_sigterm);
-  std::signal(SIGPIPE, ec_on_sigterm);
-  std::signal(SIGALRM, ec_on_sigterm);
-  std::signal(SIGTERM, ec_on_sigterm);
-  std::signal(SIGUSR1, ec_on_sigterm);
-  std::signal(SIGUSR2, ec_on_sigterm);
+/// Searches curves or PID gains over every --simulate trace.
+std::error_code run_tune(const Options& opts, std::span<const SimTrace> sims) {
+  TuneParams params = *opts.tune;
+  params.thermal    = opts.thermal.value_or(default_thermal_model);
+  params.ramp       = opts.ramp;
+  const auto       start  = std::chrono::steady_clock::now();
+  const TuneResult result = tune(
+      sims,
+      params,
+      opts.curve,
+      opts.pid.value_or(PidParams()),
+      opts.model->allowed_duties
+  );
+  const std::chrono::duration<double> took =
+      std::chrono::steady_clock::now() - start;
+
+  const bool pid  = params.mode == TuneMode::pid;
+  auto       spec = [&](const TuneCandidate& c) {
+    return pid ? format_pid_params(c.pid) : format_fan_curve(c.curve);
+  };
+  fmt::print(
+      "{} candidates in {:.1f} s, cost weights duty={:g} changes={:g} "
+      "peak={:g} hot={:g} above {}°C\n",
+      params.candidates,
+      took.count(),
+      params.duty,
+      params.changes,
+      params.peak,
+      params.hot,
+      params.limit
+  );
+  fmt::print(
+      "baseline cost {:.2f}: --{} {}\n",
+      result.baseline.cost,
+      pid ? "pid" : "curve",
+      spec(result.baseline)
+  );
+  print_sim_result("  all fans", result.baseline.result, params.limit);
+  for (const TuneCandidate& c : result.best) {
+    fmt::print(
+        "cost {:.2f}: --{} {}\n", c.cost, pid ? "pid" : "curve", spec(c)
+    );
+    print_sim_result("  all fans", c.result, params.limit);
+  }
+  return {};
 }
 
-std::error_code ec_main(std::span<std::string_view> args) {
-  if (auto err = make_error_code(ec_init())) {
-    fmt::print("unable to control EC: {}\n", err.message());
+/// Replays the traces of --simulate through the configured controller, or
+/// tunes one over them. The fans come from the profile the first trace was
+/// recorded with.
+std::error_code run_simulation(Options& opts) {
+  const auto            start = std::chrono::steady_clock::now();
+  std::vector<SimTrace> sims(opts.traces.size());
+  for (size_t i = 0; i < opts.traces.size(); ++i) {
+    TraceReader trace;
+    if (auto err = make_error_code(trace.open(opts.traces[i]))) {
+      fmt::print(
+          "unable to read trace {}: {}\n", opts.traces[i], err.message()
+      );
+      return err;
+    }
+    if (!opts.model) opts.model = find_model_profile(trace.model());
+    if (i == 0)
+      if (auto err = resolve_model(opts)) return err;
+    sims[i].load(trace, opts.model->layout.fans());
+  }
+  if (opts.tune) return run_tune(opts, sims);
+
+  const ThermalModel thermal = opts.thermal.value_or(ThermalModel());
+  size_t             samples = 0;
+  for (size_t i = 0; i < sims.size(); ++i) {
+    const SimTrace& sim = sims[i];
+    samples += sim.size() * sim.fan_count;
+    for (size_t f = 0; f < sim.fan_count; ++f) {
+      const SimResult r =
+          opts.pid
+              ? simulate_pid(sim, f, *opts.pid, opts.above, thermal)
+              : simulate_curve(
+                    sim,
+                    f,
+                    opts.curve,
+                    opts.above,
+                    thermal,
+                    opts.ramp,
+                    lowest_spinning_duty(opts.model->allowed_duties)
+                );
+      if (f == 0)
+        fmt::print(
+            "{}: {} samples over {:.1f} h, {} profile, {}\n",
+            opts.traces[i],
+            sim.size(),
+            r.duration / 3600.0,
+            opts.model->name,
+            opts.pid ? "pid" : "curve"
+        );
+      print_sim_result(opts.model->layout.fans()[f].name, r, opts.above);
+    }
+  }
+  const std::chrono::duration<double> took =
+      std::chrono::steady_clock::now() - start;
+  fmt::print(
+      "replayed in {:.1f} ms ({:.1f} M samples/s)\n",
+      took.count() * 1e3,
+      double(samples) / std::max(took.count(), 1e-9) * 1e-6
+  );
+  return {};
+}
+
+/// Runs ec_worker instantiated on whichever of \p Profiles \p model is.
+template <const ModelProfile&... Profiles>
+std::errc dispatch_worker(
+    const ModelProfile& model, EcBackend& backend, const WorkerConfig& config
+) {
+  std::errc err = std::errc::invalid_argument;
+  auto      run = [&]<const ModelProfile& Profile>() {
+    if (&model != &Profile) return false;
+    err = ec_worker<Profile>(backend, config);
+    return true;
+  };
+  (run.template operator()<Profiles>() || ...);
+  return err;
+}
+
+std::error_code run_worker(EcBackend& backend, const Options& opts) {
+  WorkerConfig config{
+      .socket_path  = opts.daemon ? opts.socket : std::string_view(),
+      .shm_name     = opts.shm.value_or(
+          opts.daemon ? SampleRingWriter::default_name : std::string_view()
+      ),
+      .record_path  = opts.record.value_or(std::string_view()),
+      .config_path  = opts.config.value_or(std::string_view()),
+      .control      = {
+          .curve      = opts.curve,
+          .pid        = opts.pid,
+          .ramp       = opts.ramp,
+          .min_period = opts.min_period,
+          .max_period = opts.max_period,
+      },
+      .backend      = *opts.backend,
+      .feed_forward = opts.feed_forward,
+      .hwmon        = opts.hwmon,
+      .realtime     = opts.realtime,
+      .stall        = opts.stall,
+      .metrics_port = opts.metrics_port,
+      .log_sink     = opts.log_sink,
+      .stats        = opts.stats,
+  };
+  // Every entry of model_profiles.
+  if (auto err = make_error_code(
+          dispatch_worker<clevo_profile, clevo_dgpu_profile>(
+              *opts.model, backend, config
+          )
+      )) {
+    fmt::print("worker failed: {}\n", err.message());
     return err;
   }
-  if (args.size() <= 1) return dump_fan(), std::error_code();
-  if (std::ranges::any_of(args.subspan(1), [](std::string_view s) {
-        return s == "--help" || s == "-h";
-      }))
-    return print_help(), dump_fan(), std::error_code();
+  return {};
+}
+
+std::error_code run(Options& opts, EcBackend& backend) {
+  if (opts.daemon && !opts.help) return run_worker(backend, opts);
+  if (opts.help) print_help();
+  if (opts.watch && !opts.help)
+    return make_error_code(
+        watch_snapshots(backend, opts.model->layout, opts.watch_params)
+    );
+  if (opts.help || !opts.duty)
+    return make_error_code(dump_fan(backend, opts.model->layout));
 
   int32_t val;
   if (auto err = make_error_code(
-          std::from_chars(args[1].begin(), args[1].end(), val).ec
+          std::from_chars(opts.duty->begin(), opts.duty->end(), val).ec
       );
       err || val < -1 || val > 100) {
-    fmt::print("invalid fan duty {}!\n", args[1]);
+    fmt::print("invalid fan duty {}!\n", *opts.duty);
     if (err) fmt::print("{}\n", err.message());
     return err;
   }
 
-  if (val == -1) {
-    install_signal_handler();
-    if (auto err = make_error_code(ec_worker())) {
-      fmt::print("worker failed: {}\n", err.message());
+  if (val == -1) return run_worker(backend, opts);
+
+  if (auto err = make_error_code(set_fan(backend, opts.model->layout, val))) {
+    fmt::print("set fan failed: {}\n", err.message());
+    return err;
+  }
+  return {};
+}
+
+/// Hands a one-shot dump or duty change to a running --daemon, so only one
+/// process drives the EC. A -1 becomes "set auto" rather than a second
+/// worker next to the daemon's. Returns nullopt when no daemon answers, and
+/// the command runs locally under the EC lock.
+std::optional<std::error_code> forward_to_daemon(const Options& opts) {
+  if (opts.daemon || opts.help || opts.watch) return std::nullopt;
+  const bool        automatic = opts.duty == "-1";
+  const std::string request   = automatic ? "set auto"
+                                : opts.duty ? fmt::format("set {}", *opts.duty)
+                                            : "get";
+  std::string reply;
+  if (int(control_request(opts.socket, request, reply))) return std::nullopt;
+
+  if (!opts.duty) {
+    fmt::print("{}", reply);
+    return std::error_code();
+  }
+  if (reply.find("\"error\"") != std::string::npos) {
+    fmt::print(
+        "daemon on {} refused duty {}: {}", opts.socket, *opts.duty, reply
+    );
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  if (automatic)
+    fmt::print(
+        "fan back on the built-in curve of the daemon on {}\n", opts.socket
+    );
+  else
+    fmt::print(
+        "fan duty {}% set by the daemon on {}\n", *opts.duty, opts.socket
+    );
+  return std::error_code();
+}
+
+std::error_code ec_main(std::span<std::string_view> args) {
+  Options opts;
+  if (auto err = parse_args(args, opts)) return print_help(), err;
+  if (opts.dump_trace) {
+    auto format = opts.format ? parse_trace_format(*opts.format)
+                              : std::optional(TraceFormat::csv);
+    if (!format) {
+      fmt::print("invalid trace format {}!\n", *opts.format);
+      return print_help(), std::make_error_code(std::errc::invalid_argument);
+    }
+    auto err = make_error_code(dump_trace(*opts.dump_trace, *format, stdout));
+    if (err)
+      fmt::print(
+          stderr, "unable to dump {}: {}\n", *opts.dump_trace, err.message()
+      );
+    return err;
+  }
+  if (!opts.traces.empty()) return run_simulation(opts);
+  if (opts.tune) {
+    fmt::print("--tune needs --simulate!\n");
+    return print_help(), std::make_error_code(std::errc::invalid_argument);
+  }
+  if (opts.format) {
+    auto format = parse_watch_format(*opts.format);
+    if (!opts.watch) {
+      fmt::print("--format needs --dump-trace or --watch!\n");
+      return print_help(), std::make_error_code(std::errc::invalid_argument);
+    }
+    if (!format) {
+      fmt::print("invalid watch format {}!\n", *opts.format);
+      return print_help(), std::make_error_code(std::errc::invalid_argument);
+    }
+    opts.watch_params.format = *format;
+  }
+  if (auto forwarded = forward_to_daemon(opts)) return *forwarded;
+  if (opts.config) {
+    // The worker reads the rest; the backend is needed before it starts.
+    ConfigFile file;
+    size_t     line = 0;
+    if (auto err =
+            make_error_code(read_config_file(*opts.config, file, line))) {
+      if (line) fmt::print("{}:{}: invalid setting\n", *opts.config, line);
+      else fmt::print("unable to read {}: {}\n", *opts.config, err.message());
       return err;
     }
-    return {};
+    if (file.backend) opts.backend = file.backend;
   }
+  // The -1 worker samples every period, so it reads through the ec_sys file
+  // unless told otherwise; one-shot commands poll the ports.
+  if (!opts.backend)
+    opts.backend = opts.daemon || opts.duty == "-1" ? EcBackendKind::debugfs
+                                                     : EcBackendKind::port;
+  if (auto err = resolve_model(opts)) return err;
 
-  if (auto err = make_error_code(set_fan(val))) {
-    fmt::print("set fan failed: {}\n", err.message());
+  if (opts.backend == EcBackendKind::debugfs) load_ec_sys();
+  EcLock lock, worker_lock;
+  auto   backend = make_ec_backend(*opts.backend);
+  if (auto err = make_error_code(backend->open())) {
+    fmt::print("unable to control EC: {}\n", err.message());
     return err;
   }
-  return {};
+  // The mock EC lives in this process; lock it only when asked to.
+  if (opts.backend != EcBackendKind::mock || opts.lock) {
+    // Running setuid root, only root may create lock files elsewhere.
+    std::string_view path = opts.lock.value_or(EcLock::default_path);
+    if (path != EcLock::default_path && getuid() != 0) {
+      fmt::print(stderr, "--lock needs root, using {}\n", EcLock::default_path);
+      path = EcLock::default_path;
+    }
+    if (auto err = make_error_code(lock.open(path)))
+      fmt::print(
+          stderr,
+          "unable to open EC lock {}: {}, running unlocked\n",
+          path,
+          err.message()
+      );
+    else backend->set_lock(&lock);
+
+    // Held until exit, so a second worker does not fight over the duty.
+    const std::string worker_path =
+        fmt::format("{}{}", path, EcLock::worker_suffix);
+    if (opts.daemon || opts.duty == "-1") {
+      if (auto err = make_error_code(worker_lock.open(worker_path)))
+        fmt::print(
+            stderr,
+            "unable to open worker lock {}: {}, not checking for other "
+            "workers\n",
+            worker_path,
+            err.message()
+        );
+      else if (auto held = make_error_code(worker_lock.try_acquire())) {
+        fmt::print(
+            "another -1 worker or --daemon controls the fans ({}: {})\n",
+            worker_path,
+            held.message()
+        );
+        return held;
+      }
+    }
+  }
+
+  auto err = run(opts, *backend);
+  if (opts.stats) {
+    print_ec_backend_stats(*backend);
+    print_ec_wait_stats();
+  }
+  return err;
 }
 } // namespace
+} // namespace clevo
 
 int main(const int argc, const char* argv[]) {
   const auto arg_cnt = static_cast<std::size_t>(argc);
@@ -332,5 +1146,5 @@ int main(const int argc, const char* argv[]) {
   args.reserve(arg_cnt);
   std::copy_n(argv, arg_cnt, std::back_inserter(args));
 
-  return ec_main(args) ? EXIT_FAILURE : EXIT_SUCCESS;
-}
\ No newline at end of file
+  return clevo::ec_main(args) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
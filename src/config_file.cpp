@@ -0,0 +1,161 @@
+//===- config_file.cpp - Hot-reloadable worker settings ---------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the config file parser and the inotify watcher.
+///
+//===----------------------------------------------------------------------===//
+
+#include "config_file.h"
+
+#include <sys/inotify.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+
+namespace clevo {
+namespace {
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() &&
+         (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
+
+std::optional<std::chrono::milliseconds> parse_ms(std::string_view value) {
+  int64_t ms;
+  auto    res = std::from_chars(value.begin(), value.end(), ms);
+  if (res.ec != std::errc() || res.ptr != value.end() || ms <= 0)
+    return std::nullopt;
+  return std::chrono::milliseconds(ms);
+}
+} // namespace
+
+std::errc
+parse_config_file(std::string_view text, ConfigFile& config, size_t& line) {
+  ConfigFile parsed;
+  line = 0;
+  while (!text.empty()) {
+    const size_t     newline = text.find('\n');
+    std::string_view item    = text.substr(0, newline);
+    text = newline == std::string_view::npos ? std::string_view()
+                                             : text.substr(newline + 1);
+    ++line;
+
+    item = trim(item.substr(0, item.find('#')));
+    if (item.empty()) continue;
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key   = trim(item.substr(0, eq));
+    std::string_view value = trim(item.substr(eq + 1));
+
+    if (key == "backend") {
+      if (!(parsed.backend = parse_ec_backend_kind(value)))
+        return std::errc::invalid_argument;
+    } else if (key == "curve") {
+      parsed.curve = value;
+    } else if (key == "mode") {
+      if (value == "curve") parsed.use_pid = false;
+      else if (value == "pid") parsed.use_pid = true;
+      else return std::errc::invalid_argument;
+    } else if (key == "pid") {
+      parsed.pid = value;
+    } else if (key == "ramp") {
+      parsed.ramp = value;
+    } else if (key == "interval-min") {
+      if (!(parsed.min_period = parse_ms(value)))
+        return std::errc::invalid_argument;
+    } else if (key == "interval-max") {
+      if (!(parsed.max_period = parse_ms(value)))
+        return std::errc::invalid_argument;
+    } else {
+      return std::errc::invalid_argument;
+    }
+  }
+  config = parsed;
+  return std::errc();
+}
+
+std::errc
+read_config_file(std::string_view path, ConfigFile& config, size_t& line) {
+  line = 0;
+  UniqueFd fd(::open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC));
+  if (!fd.valid()) return std::errc(errno);
+  std::string text;
+  char        buf[4096];
+  ssize_t     len;
+  while ((len = read(fd.get(), buf, sizeof(buf))) > 0)
+    text.append(buf, size_t(len));
+  if (len < 0) return std::errc(errno);
+  return parse_config_file(text, config, line);
+}
+
+std::errc apply_config_file(
+    const ConfigFile&        config,
+    std::span<const int32_t> allowed_duties,
+    ControlSettings&         settings
+) {
+  ControlSettings next = settings;
+  if (config.curve)
+    if (auto err = parse_fan_curve(*config.curve, next.curve, allowed_duties);
+        int(err))
+      return err;
+  if (config.pid) {
+    PidParams pid = next.pid.value_or(PidParams());
+    if (auto err = parse_pid_params(*config.pid, pid); int(err)) return err;
+    next.pid = pid;
+  }
+  if (config.use_pid == false) next.pid.reset();
+  else if (config.use_pid == true && !next.pid) next.pid.emplace();
+  if (config.ramp)
+    if (auto err = parse_ramp_params(*config.ramp, next.ramp); int(err))
+      return err;
+  next.min_period = config.min_period.value_or(next.min_period);
+  next.max_period = config.max_period.value_or(next.max_period);
+  if (next.min_period > next.max_period) return std::errc::invalid_argument;
+  settings = next;
+  return std::errc();
+}
+
+std::errc ConfigWatcher::open(std::string_view path) {
+  const size_t      slash = path.rfind('/');
+  const std::string dir(
+      slash == std::string_view::npos ? std::string_view(".")
+      : slash == 0                    ? std::string_view("/")
+                                      : path.substr(0, slash)
+  );
+  name_ = path.substr(slash == std::string_view::npos ? 0 : slash + 1);
+
+  // Created files are only read once closed, never half written.
+  const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+  UniqueFd       fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  if (!fd.valid()) return std::errc(errno);
+  if (inotify_add_watch(fd.get(), dir.c_str(), mask) < 0)
+    return std::errc(errno);
+  fd_ = std::move(fd);
+  return std::errc();
+}
+
+bool ConfigWatcher::changed() {
+  alignas(inotify_event) char buf[4096];
+  bool                        hit = false;
+  ssize_t                     len;
+  while ((len = read(fd_.get(), buf, sizeof(buf))) > 0) {
+    for (ssize_t off = 0; off < len;) {
+      const auto* event = reinterpret_cast<const inotify_event*>(buf + off);
+      // The name is NUL padded up to event->len.
+      if (event->len && std::string_view(event->name) == name_) hit = true;
+      off += ssize_t(sizeof(inotify_event) + event->len);
+    }
+  }
+  return hit;
+}
+} // namespace clevo
@@ -0,0 +1,98 @@
+//===- config_file.h - Hot-reloadable worker settings -----------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// A config file of "key = value" lines for the -1 worker, watched with
+/// inotify so tuning changes apply without a restart. Values use the syntax
+/// of the matching command line options:
+///
+///   # comments and blank lines are ignored
+///   backend      = port          # port|debugfs|mock, read at startup only
+///   curve        = 55:17:5,65:30:5,75:40:5,85:65:5
+///   mode         = pid           # curve|pid
+///   pid          = setpoint=60,kp=4
+///   ramp         = up=20,down=5
+///   interval-min = 250
+///   interval-max = 4000
+///
+/// Keys missing from the file keep their command line value. A file that
+/// fails to parse or validate is rejected whole; the running settings stay.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_CONFIG_FILE_H
+#define CLEVO_CONFIG_FILE_H
+
+#include "duty_ramp.h"
+#include "ec_backend.h"
+#include "event_loop.h"
+#include "fan_curve.h"
+#include "pid.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+/// The worker settings a config file may change while it runs.
+struct ControlSettings {
+  FanCurve                  curve = default_fan_curve;
+  std::optional<PidParams>  pid; ///< PID control instead of the curve
+  RampParams                ramp;
+  std::chrono::milliseconds min_period{250};
+  std::chrono::milliseconds max_period{4000};
+};
+
+/// The keys set by a config file; absent keys stay empty.
+struct ConfigFile {
+  std::optional<EcBackendKind>             backend;
+  std::optional<std::string>               curve;
+  std::optional<bool>                      use_pid; ///< from mode
+  std::optional<std::string>               pid;
+  std::optional<std::string>               ramp;
+  std::optional<std::chrono::milliseconds> min_period;
+  std::optional<std::chrono::milliseconds> max_period;
+};
+
+/// Parses the lines of \p text into \p config. On failure \p line is the
+/// 1-based line at fault.
+std::errc
+parse_config_file(std::string_view text, ConfigFile& config, size_t& line);
+
+/// Reads and parses the file at \p path; \p line is 0 when reading failed.
+std::errc
+read_config_file(std::string_view path, ConfigFile& config, size_t& line);
+
+/// Overlays \p config on \p settings, checking the curve against
+/// \p allowed_duties. \p settings is only changed when every key is valid.
+std::errc apply_config_file(
+    const ConfigFile&        config,
+    std::span<const int32_t> allowed_duties,
+    ControlSettings&         settings
+);
+
+/// Watches the directory of a file, so editors and deployment tools that
+/// replace it by a rename are noticed as well as in-place writes.
+class ConfigWatcher {
+public:
+  std::errc open(std::string_view path);
+  int       fd() const { return fd_.get(); }
+
+  /// Consumes the pending events; true if one concerned the file.
+  bool changed();
+
+private:
+  UniqueFd    fd_;
+  std::string name_;
+};
+} // namespace clevo
+
+#endif // CLEVO_CONFIG_FILE_H
@@ -0,0 +1,276 @@
+//===- control_socket.cpp - Unix socket control API -------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the line based control protocol over a Unix domain socket.
+///
+//===----------------------------------------------------------------------===//
+
+#include "control_socket.h"
+
+#include <fmt/format.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <iterator>
+#include <optional>
+
+namespace clevo {
+namespace {
+constexpr std::string_view ok_line = "{\"ok\":true}\n";
+
+/// Parses the argument of "set": a duty in 0-100 or "auto" (-1).
+std::optional<int32_t> parse_duty(std::string_view arg) {
+  if (arg == "auto") return -1;
+  int32_t duty;
+  auto    res = std::from_chars(arg.begin(), arg.end(), duty);
+  if (res.ec != std::errc() || res.ptr != arg.end() || duty < 0 || duty > 100)
+    return std::nullopt;
+  return duty;
+}
+
+std::string error_line(std::errc err) {
+  return fmt::format(
+      "{{\"error\":\"{}\"}}\n", std::make_error_code(err).message()
+  );
+}
+
+/// Returns the uid of the process connected on \p fd, or -1 if unknown.
+uid_t peer_uid(int fd) {
+  ucred     cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return uid_t(-1);
+  return cred.uid;
+}
+
+/// Whether a server accepts connections on \p addr.
+bool server_listening(const sockaddr_un& addr) {
+  UniqueFd fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  return fd.valid() &&
+         connect(
+             fd.get(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)
+         ) == 0;
+}
+} // namespace
+
+std::string format_snapshot_line(const EcSnapshot& snap, bool manual) {
+  std::string fans;
+  if (snap.fan_count > 1) {
+    fans = ",\"fans\":[";
+    for (size_t i = 0; i < snap.fan_count; ++i)
+      fmt::format_to(
+          std::back_inserter(fans),
+          "{}{{\"name\":\"{}\",\"duty\":{},\"rpms\":{}}}",
+          i ? "," : "",
+          snap.fans[i].name,
+          snap.fans[i].duty,
+          snap.fans[i].rpms
+      );
+    fans += ']';
+  }
+  return fmt::format(
+      "{{\"duty\":{},\"rpms\":{},\"cpu_temp_cels\":{},\"gpu_temp_cels\":{},"
+      "\"mode\":\"{}\"{}}}\n",
+      snap.duty,
+      snap.rpms,
+      snap.cpu_temp,
+      snap.gpu_temp,
+      manual ? "manual" : "auto",
+      fans
+  );
+}
+
+std::errc control_request(
+    std::string_view path, std::string_view line, std::string& reply
+) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) return std::errc::filename_too_long;
+  std::copy(path.begin(), path.end(), addr.sun_path);
+
+  UniqueFd fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!fd.valid()) return std::errc(errno);
+  // A wedged server must not hang a one-shot command.
+  const timeval timeout{.tv_sec = 2, .tv_usec = 0};
+  setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd.get(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if (connect(fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    return std::errc(errno);
+
+  const std::string request = fmt::format("{}\n", line);
+  if (send(fd.get(), request.data(), request.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(request.size()))
+    return std::errc(errno);
+
+  reply.clear();
+  char buf[512];
+  while (reply.find('\n') == std::string::npos) {
+    ssize_t len = recv(fd.get(), buf, sizeof(buf), 0);
+    if (len == 0) return std::errc::connection_reset;
+    if (len < 0) return std::errc(errno);
+    reply.append(buf, static_cast<size_t>(len));
+  }
+  reply.resize(reply.find('\n') + 1);
+  return std::errc();
+}
+
+ControlServer::~ControlServer() {
+  for (auto& c : clients_) close_client(c);
+  if (listen_fd_ >= 0) {
+    loop_.remove(listen_fd_);
+    close(listen_fd_);
+    // Only the socket this process bound; a successor may have replaced it.
+    struct stat st;
+    if (lstat(path_.c_str(), &st) == 0 && st.st_dev == dev_ &&
+        st.st_ino == ino_)
+      unlink(path_.c_str());
+  }
+}
+
+std::errc ControlServer::listen(std::string_view path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) return std::errc::filename_too_long;
+  std::copy(path.begin(), path.end(), addr.sun_path);
+
+  // The binary runs setuid root: never take over a live daemon's socket,
+  // and never unlink anything but a stale socket.
+  if (server_listening(addr)) return std::errc::address_in_use;
+  path_ = path;
+  struct stat st;
+  if (lstat(path_.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) return std::errc::file_exists;
+    if (unlink(path_.c_str()) < 0) return std::errc(errno);
+  } else if (errno != ENOENT) {
+    return std::errc(errno);
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) return std::errc(errno);
+  // The socket is created 0660 so no other user can connect before chmod.
+  const mode_t mask  = umask(0117);
+  const int    bound = bind(
+      listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)
+  );
+  const int bind_errno = errno;
+  umask(mask);
+  if (bound < 0) return std::errc(bind_errno);
+  if (lstat(path_.c_str(), &st) < 0 || chmod(path_.c_str(), 0660) < 0 ||
+      ::listen(listen_fd_, 8) < 0)
+    return std::errc(errno);
+  dev_ = st.st_dev;
+  ino_ = st.st_ino;
+  return loop_.add(listen_fd_, EPOLLIN, [this](uint32_t) {
+    accept_clients();
+  });
+}
+
+void ControlServer::publish(const EcSnapshot& snap) {
+  const auto line = format_snapshot_line(snap, handler_.manual());
+  for (auto& c : clients_)
+    if (c.subscribed && !send_line(c, line)) close_client(c);
+  drop_closed();
+}
+
+void ControlServer::accept_clients() {
+  while (true) {
+    int fd =
+        accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    auto on_ready = [this, fd](uint32_t) { on_client_ready(fd); };
+    if (int(loop_.add(fd, EPOLLIN, on_ready))) {
+      close(fd);
+      continue;
+    }
+    clients_.push_back({.fd = fd, .uid = peer_uid(fd)});
+  }
+}
+
+void ControlServer::on_client_ready(int fd) {
+  auto it = std::ranges::find(clients_, fd, &Client::fd);
+  if (it == clients_.end()) return;
+  if (!read_client(*it)) close_client(*it);
+  drop_closed();
+}
+
+bool ControlServer::read_client(Client& client) {
+  char buf[512];
+  while (true) {
+    ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+    if (len == 0) return false;
+    if (len < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    client.in.append(buf, static_cast<size_t>(len));
+
+    size_t pos;
+    while ((pos = client.in.find('\n')) != std::string::npos) {
+      std::string line = client.in.substr(0, pos);
+      client.in.erase(0, pos + 1);
+      if (!dispatch(client, line)) return false;
+    }
+    // A peer that never sends a newline is not a well-behaved client.
+    if (client.in.size() > sizeof(buf)) return false;
+  }
+}
+
+bool ControlServer::dispatch(Client& client, std::string_view line) {
+  while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+    line.remove_suffix(1);
+
+  if (line == "get")
+    return send_line(
+        client, format_snapshot_line(handler_.snapshot(), handler_.manual())
+    );
+  if (line == "subscribe")
+    return client.subscribed = true, send_line(client, ok_line);
+  if (line == "sleep" || line == "wake") {
+    // Either one changes how the fans are driven for every client.
+    if (client.uid != 0)
+      return send_line(client, error_line(std::errc::operation_not_permitted));
+    if (line == "wake") {
+      if (!handler_.sleeping())
+        return send_line(client, "{\"error\":\"not sleeping\"}\n");
+      return handler_.resume(), send_line(client, ok_line);
+    }
+    if (auto err = handler_.suspend(); int(err))
+      return send_line(client, error_line(err));
+    return send_line(client, ok_line);
+  }
+  if (line.starts_with("set ")) {
+    auto duty = parse_duty(line.substr(4));
+    if (!duty) return send_line(client, "{\"error\":\"invalid duty\"}\n");
+    if (auto err = handler_.set_duty(*duty); int(err))
+      return send_line(client, error_line(err));
+    return send_line(client, ok_line);
+  }
+  return send_line(client, "{\"error\":\"unknown request\"}\n");
+}
+
+bool ControlServer::send_line(Client& client, std::string_view line) {
+  // Replies are small; a client whose buffer is full is too slow to keep.
+  ssize_t len =
+      send(client.fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+  return len == static_cast<ssize_t>(line.size());
+}
+
+void ControlServer::close_client(Client& client) {
+  loop_.remove(client.fd);
+  close(client.fd);
+  client.fd = -1;
+}
+
+void ControlServer::drop_closed() {
+  std::erase_if(clients_, [](const Client& c) { return c.fd < 0; });
+}
+} // namespace clevo
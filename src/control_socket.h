@@ -0,0 +1,118 @@
+//===- control_socket.h - Unix socket control API ---------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Serves the running worker over a Unix domain socket so external
+/// controllers can query and set the fan without spawning the binary and
+/// without touching the EC themselves.
+///
+/// The protocol is line based. Requests:
+///   get            reply with the latest snapshot
+///   set <0-100>    command a fixed duty (manual mode)
+///   set auto       hand control back to the built-in curve
+///   subscribe      receive a snapshot line after every sample
+///   sleep          hand the fans back to the EC before a system suspend
+///   wake           take them back after a sleep request; a resume is also
+///                  detected without it
+/// Only root may send sleep and wake.
+/// Every reply is one JSON object terminated by a newline.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_CONTROL_SOCKET_H
+#define CLEVO_CONTROL_SOCKET_H
+
+#include "ec_snapshot.h"
+#include "event_loop.h"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace clevo {
+/// Implemented by the worker to answer control requests.
+class ControlHandler {
+public:
+  virtual ~ControlHandler() = default;
+
+  virtual const EcSnapshot& snapshot() const = 0;
+
+  /// True while a client-commanded duty overrides the automatic curve.
+  virtual bool manual() const = 0;
+
+  /// Commands \p duty (0-100), or -1 to return to automatic control.
+  virtual std::errc set_duty(int32_t duty) = 0;
+
+  /// Stops controlling the fans until resume(), e.g. for a system suspend.
+  virtual std::errc suspend() = 0;
+
+  /// True between suspend() and resume().
+  virtual bool sleeping() const = 0;
+
+  virtual void resume() = 0;
+};
+
+/// Formats \p snap as a single JSON line.
+std::string format_snapshot_line(const EcSnapshot& snap, bool manual);
+
+/// Sends the request \p line to the server listening on \p path and stores
+/// its reply line, newline included, in \p reply. Fails with the connect()
+/// error, e.g. no_such_file_or_directory or connection_refused, when no
+/// server is running.
+std::errc control_request(
+    std::string_view path, std::string_view line, std::string& reply
+);
+
+class ControlServer {
+public:
+  static constexpr std::string_view default_path = "/run/clevo-fancontrol.sock";
+
+  ControlServer(ControlHandler& handler, EventLoop& loop)
+      : handler_(handler), loop_(loop) {}
+  ControlServer(const ControlServer&)            = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+  ~ControlServer();
+
+  /// Binds and listens on \p path and serves requests from the event loop.
+  /// A stale socket file is replaced; fails with address_in_use when a
+  /// server still answers on \p path and with file_exists when it is not a
+  /// socket.
+  std::errc listen(std::string_view path);
+
+  /// Sends \p snap to every subscribed client.
+  void publish(const EcSnapshot& snap);
+
+private:
+  struct Client {
+    int         fd         = -1;
+    std::string in         = {};
+    bool        subscribed = false;
+    uid_t       uid        = uid_t(-1); ///< of the peer, from SO_PEERCRED
+  };
+
+  void accept_clients();
+  void on_client_ready(int fd);
+  bool read_client(Client& client);
+  bool dispatch(Client& client, std::string_view line);
+  bool send_line(Client& client, std::string_view line);
+  void close_client(Client& client);
+  void drop_closed();
+
+  ControlHandler&     handler_;
+  EventLoop&          loop_;
+  int                 listen_fd_ = -1;
+  std::string         path_;
+  dev_t               dev_ = 0; ///< of the socket file bound
+  ino_t               ino_ = 0;
+  std::vector<Client> clients_;
+};
+} // namespace clevo
+
+#endif // CLEVO_CONTROL_SOCKET_H
@@ -0,0 +1,68 @@
+//===- duty_ramp.cpp - Time based duty ramp ---------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the duty ramp and its parameter parser.
+///
+//===----------------------------------------------------------------------===//
+
+#include "duty_ramp.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace clevo {
+std::errc parse_ramp_params(std::string_view spec, RampParams& params) {
+  RampParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    double v;
+    auto   res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end() || v < 0)
+      return std::errc::invalid_argument;
+
+    if (key == "up") parsed.up = v;
+    else if (key == "down") parsed.down = v;
+    else if (key == "step" && v >= 1)
+      parsed.step = std::chrono::milliseconds(std::lround(v));
+    else return std::errc::invalid_argument;
+  }
+  params = parsed;
+  return std::errc();
+}
+
+void DutyRamp::set_target(int32_t current, int32_t target, time_point now) {
+  if (active()) advance(now);
+  else position_ = current, last_ = now;
+  target_ = target;
+}
+
+int32_t DutyRamp::advance(time_point now) {
+  const double dt = std::chrono::duration<double>(now - last_).count();
+  last_           = now;
+
+  const double rate = target_ > position_ ? params_.up : params_.down;
+  if (rate <= 0) {
+    position_ = target_;
+  } else {
+    const double step = rate * std::max(dt, 0.0);
+    position_ = std::clamp(double(target_), position_ - step, position_ + step);
+  }
+  // Spinning up starts at min_duty_, spinning down stops below it.
+  if (position_ > 0 && std::lround(position_) < min_duty_)
+    position_ = target_ > position_ ? std::min(min_duty_, target_) : target_;
+  return static_cast<int32_t>(std::lround(position_));
+}
+} // namespace clevo
@@ -0,0 +1,83 @@
+//===- duty_ramp.h - Time based duty ramp -----------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Moves the fan duty towards a target at a fixed rate in %/s, with separate
+/// rates for spinning up and down, so the ramp does not depend on how often
+/// the worker samples. Steps between 0 and the lowest duty the fan spins at
+/// would only stall it, so the ramp jumps over them.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_DUTY_RAMP_H
+#define CLEVO_DUTY_RAMP_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+struct RampParams {
+  double                    up   = 20.0; ///< %/s while increasing, 0 = jump
+  double                    down = 5.0;  ///< %/s while decreasing, 0 = jump
+  std::chrono::milliseconds step{200};   ///< period of intermediate writes
+};
+
+/// Parses "key=value,..." with the keys up, down and step (ms) on top of the
+/// defaults in \p params.
+std::errc parse_ramp_params(std::string_view spec, RampParams& params);
+
+/// The lowest non-zero duty of \p allowed, the EC steps of a profile; 0
+/// when there is none.
+constexpr int32_t lowest_spinning_duty(std::span<const int32_t> allowed) {
+  int32_t lowest = 0;
+  for (int32_t d : allowed)
+    if (d > 0 && (lowest == 0 || d < lowest)) lowest = d;
+  return lowest;
+}
+
+class DutyRamp {
+public:
+  using clock      = std::chrono::steady_clock;
+  using time_point = clock::time_point;
+
+  /// \p min_duty is the lowest duty the fan spins at; the ramp never
+  /// commands a duty between 0 and it.
+  explicit DutyRamp(const RampParams& params = {}, int32_t min_duty = 0)
+      : params_(params), min_duty_(min_duty) {}
+
+  /// Ramps towards \p target from the current ramp position, or from
+  /// \p current when no ramp is in progress.
+  void set_target(int32_t current, int32_t target, time_point now);
+
+  /// Advances the ramp to \p now and returns the duty to command.
+  int32_t advance(time_point now);
+
+  /// Stops ramping; the next set_target starts from its \p current.
+  void reset() { target_ = -1; }
+
+  /// Changes the rates, continuing a ramp in progress from its position.
+  void set_params(const RampParams& params) { params_ = params; }
+
+  void set_min_duty(int32_t min_duty) { min_duty_ = min_duty; }
+
+  bool active() const { return target_ >= 0 && position_ != target_; }
+  int32_t           target() const { return target_; }
+  const RampParams& params() const { return params_; }
+
+private:
+  RampParams params_;
+  int32_t    min_duty_ = 0;
+  double     position_ = 0.0;
+  int32_t    target_   = -1;
+  time_point last_{};
+};
+} // namespace clevo
+
+#endif // CLEVO_DUTY_RAMP_H
@@ -0,0 +1,214 @@
+//===- ec_backend.cpp - EC transport backends -------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the port I/O, debugfs and mock EC backends.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_backend.h"
+
+#include "ec_lock.h"
+
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+namespace clevo {
+std::vector<EcRange>
+coalesce_ec_registers(std::span<const size_t> regs, size_t max_gap) {
+  std::vector<EcRange> ranges(regs.size());
+  ranges.resize(coalesce_ec_registers(regs, ranges, max_gap));
+  return ranges;
+}
+
+template <typename F>
+std::errc EcBackend::record(size_t transactions, F&& op) {
+  std::chrono::nanoseconds waited{0};
+  if (lock_)
+    if (auto err = lock_->acquire(waited); int(err)) {
+      stats_.errors += 1;
+      return err;
+    }
+  if (waited.count()) stats_.lock_wait.add(waited);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::errc  err   = op();
+  const auto took  = std::chrono::steady_clock::now() - start;
+  if (lock_) lock_->release();
+
+  stats_.operations += 1;
+  stats_.transactions += transactions;
+  stats_.total_latency += took;
+  stats_.max_latency = std::max<std::chrono::nanoseconds>(
+      stats_.max_latency, took
+  );
+  stats_.latency.add(took);
+  if (err == std::errc::message_size) stats_.short_reads += 1;
+  if (int(err)) stats_.errors += 1;
+  return err;
+}
+
+std::errc EcBackend::read(size_t reg, std::span<uint8_t> out) {
+  if (!in_bounds(reg, out.size())) return std::errc::invalid_argument;
+  return record(out.size(), [&] { return do_read(reg, out); });
+}
+
+std::errc
+EcBackend::read_ranges(std::span<const EcRange> ranges, EcRegisters& regs) {
+  size_t transactions = 0;
+  for (const auto& r : ranges) {
+    if (!in_bounds(r.offset, r.length)) return std::errc::invalid_argument;
+    transactions += r.length;
+  }
+  return record(transactions, [&] {
+    for (const auto& r : ranges) {
+      auto out = std::span(regs).subspan(r.offset, r.length);
+      if (auto err = do_read(r.offset, out); int(err)) return err;
+    }
+    return std::errc();
+  });
+}
+
+std::errc EcBackend::write(size_t reg, uint8_t value) {
+  if (!in_bounds(reg, 1)) return std::errc::invalid_argument;
+  return record(1, [&] { return do_write(reg, value); });
+}
+
+std::errc EcBackend::write_fan_duty(const EcFan& fan, uint8_t raw_duty) {
+  return record(1, [&] { return do_write_fan_duty(fan, raw_duty); });
+}
+
+//===----------------------------------------------------------------------===//
+// DebugfsBackend
+//===----------------------------------------------------------------------===//
+
+DebugfsBackend::~DebugfsBackend() { close_fd(); }
+
+std::errc DebugfsBackend::open() {
+  close_fd();
+  fd_       = ::open(path_.c_str(), O_RDWR | O_CLOEXEC, 0);
+  writable_ = fd_ >= 0;
+  if (fd_ < 0) fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd_ < 0) return std::errc(errno);
+  return std::errc();
+}
+
+void DebugfsBackend::close_fd() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+}
+
+std::errc DebugfsBackend::do_read(size_t reg, std::span<uint8_t> out) {
+  // A stale fd (e.g. ec_sys reloaded) is reopened once before giving up.
+  int err = 0;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (fd_ < 0)
+      if (auto open_err = open(); int(open_err)) return open_err;
+    ssize_t len = pread(fd_, out.data(), out.size(), static_cast<off_t>(reg));
+    if (len >= 0)
+      return static_cast<size_t>(len) == out.size() ? std::errc()
+                                                    : std::errc::message_size;
+    err = errno;
+    close_fd();
+  }
+  return std::errc(err);
+}
+
+std::errc DebugfsBackend::do_write(size_t reg, uint8_t value) {
+  if (!writable_) {
+    fmt::print("{} is read-only, load ec_sys with write_support=1\n", path_);
+    return std::errc::permission_denied;
+  }
+  if (pwrite(fd_, &value, 1, static_cast<off_t>(reg)) != 1)
+    return std::errc(errno);
+  return std::errc();
+}
+
+std::errc
+DebugfsBackend::do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) {
+  // The duty register only reports the duty; the EC sets it on command 0x99.
+  if (!ports_open_) {
+    if (auto err = ports_.open(); int(err)) return err;
+    ports_open_ = true;
+  }
+  return ec_io_do(
+      ports_, ec_wait_stats(), k::ec_fan_duty_cmd, fan.index, raw_duty
+  );
+}
+
+//===----------------------------------------------------------------------===//
+// MockEcBackend
+//===----------------------------------------------------------------------===//
+
+std::errc MockEcBackend::do_read(size_t reg, std::span<uint8_t> out) {
+  std::copy_n(
+      regs.begin() + static_cast<ptrdiff_t>(reg), out.size(), out.begin()
+  );
+  return std::errc();
+}
+
+std::errc MockEcBackend::do_write(size_t reg, uint8_t value) {
+  regs[reg] = value;
+  return std::errc();
+}
+
+std::errc MockEcBackend::do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) {
+  regs[fan.duty_reg] = raw_duty;
+  return std::errc();
+}
+
+//===----------------------------------------------------------------------===//
+
+std::optional<EcBackendKind> parse_ec_backend_kind(std::string_view name) {
+  if (name == "port") return EcBackendKind::port;
+  if (name == "debugfs") return EcBackendKind::debugfs;
+  if (name == "mock") return EcBackendKind::mock;
+  return std::nullopt;
+}
+
+std::unique_ptr<EcBackend> make_ec_backend(EcBackendKind kind) {
+  switch (kind) {
+  case EcBackendKind::port: return std::make_unique<PortIoBackend>();
+  case EcBackendKind::debugfs: return std::make_unique<DebugfsBackend>();
+  case EcBackendKind::mock: return std::make_unique<MockEcBackend>();
+  }
+  return nullptr;
+}
+
+void print_ec_backend_stats(const EcBackend& backend) {
+  const auto& s   = backend.stats();
+  const auto  avg = s.operations ? s.total_latency.count() /
+                                       static_cast<int64_t>(s.operations)
+                                 : 0;
+  fmt::print(
+      stderr,
+      "{} backend: {} ops, {} transactions, {} errors, {} short reads, "
+      "avg {} ns, max {} ns\n",
+      backend.name(),
+      s.operations,
+      s.transactions,
+      s.errors,
+      s.short_reads,
+      avg,
+      s.max_latency.count()
+  );
+  if (s.lock_wait.count)
+    fmt::print(
+        stderr,
+        "EC lock: {} of {} ops waited, avg {} ns, max {} ns\n",
+        s.lock_wait.count,
+        s.operations,
+        s.lock_wait.total.count() / static_cast<int64_t>(s.lock_wait.count),
+        s.lock_wait.max.count()
+    );
+}
+} // namespace clevo
@@ -0,0 +1,274 @@
+//===- ec_backend.h - EC transport backends ---------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Declares the transports used to read and write EC registers: raw port I/O,
+/// the ec_sys debugfs file and an in-memory mock. Every command must pick one
+/// backend and use it exclusively so port and debugfs accesses never mix.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EC_BACKEND_H
+#define CLEVO_EC_BACKEND_H
+
+#include "ec_io.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace clevo {
+class EcLock;
+
+using EcRegisters = std::array<uint8_t, k::ec_reg_size>;
+
+/// A contiguous run of EC registers.
+struct EcRange {
+  size_t offset;
+  size_t length;
+};
+
+/// Sorts \p regs and merges registers at most \p max_gap apart into the
+/// ranges at the front of \p out, which must hold regs.size() entries.
+/// Returns the number of ranges.
+constexpr size_t coalesce_ec_registers(
+    std::span<const size_t> regs, std::span<EcRange> out, size_t max_gap = 2
+) {
+  const size_t n = std::min(regs.size(), out.size());
+  for (size_t i = 0; i < n; ++i) out[i] = {regs[i], 1};
+  std::ranges::sort(out.first(n), {}, &EcRange::offset);
+
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const size_t reg  = out[i].offset;
+    EcRange*     last = count ? &out[count - 1] : nullptr;
+    if (last && reg <= last->offset + last->length + max_gap) {
+      last->length = std::max(last->length, reg - last->offset + 1);
+      continue;
+    }
+    out[count++] = {reg, 1};
+  }
+  return count;
+}
+
+/// Sorts \p regs and merges registers at most \p max_gap apart into ranges.
+std::vector<EcRange>
+coalesce_ec_registers(std::span<const size_t> regs, size_t max_gap = 2);
+
+/// Temperature register a fan is controlled from.
+enum class EcFanSensor { hottest, cpu, gpu };
+
+/// Registers and duty command index of one fan.
+struct EcFan {
+  std::string_view name;
+  uint8_t          index;       ///< fan argument of ec_fan_duty_cmd
+  size_t           duty_reg;    ///< raw duty (0-255)
+  size_t           rpms_hi_reg; ///< tachometer period, high byte
+  size_t           rpms_lo_reg; ///< tachometer period, low byte
+  EcFanSensor      sensor;
+};
+
+/// Chassis with one fan cooling both the CPU and the GPU.
+constexpr std::array<EcFan, 1> ec_single_fan = {{
+    {"fan",
+     0x01,
+     k::ec_reg_fan_duty,
+     k::ec_reg_fan_rpms_hi,
+     k::ec_reg_fan_rpms_lo,
+     EcFanSensor::hottest},
+}};
+
+/// Chassis with a discrete GPU and a fan of its own.
+constexpr std::array<EcFan, 2> ec_dual_fans = {{
+    {"cpu",
+     0x01,
+     k::ec_reg_fan_duty,
+     k::ec_reg_fan_rpms_hi,
+     k::ec_reg_fan_rpms_lo,
+     EcFanSensor::cpu},
+    {"gpu",
+     0x02,
+     k::ec_reg_gpu_fan_duty,
+     k::ec_reg_gpu_fan_rpms_hi,
+     k::ec_reg_gpu_fan_rpms_lo,
+     EcFanSensor::gpu},
+}};
+
+/// Counters kept by every backend.
+struct EcBackendStats {
+  uint64_t                 operations   = 0;
+  uint64_t                 transactions = 0;
+  uint64_t                 errors       = 0;
+  uint64_t                 short_reads  = 0;
+  std::chrono::nanoseconds total_latency{0};
+  std::chrono::nanoseconds max_latency{0};
+  EcWaitHistogram          latency;   ///< per operation
+  EcWaitHistogram          lock_wait; ///< operations that waited for EcLock
+};
+
+enum class EcBackendKind { port, debugfs, mock };
+
+class EcBackend {
+public:
+  EcBackend()                            = default;
+  EcBackend(const EcBackend&)            = delete;
+  EcBackend& operator=(const EcBackend&) = delete;
+  virtual ~EcBackend()                   = default;
+
+  virtual std::string_view name() const = 0;
+
+  /// Acquires whatever the transport needs (port permissions, file handles).
+  virtual std::errc open() = 0;
+
+  /// Reads \p out.size() consecutive registers starting at \p reg. A
+  /// transport that returns fewer bytes reports std::errc::message_size.
+  std::errc read(size_t reg, std::span<uint8_t> out);
+
+  /// Reads every range of \p ranges into the matching slots of \p regs as
+  /// one batched operation.
+  std::errc read_ranges(std::span<const EcRange> ranges, EcRegisters& regs);
+
+  /// Writes a single EC register.
+  std::errc write(size_t reg, uint8_t value);
+
+  /// Sets the raw duty (0-255) of \p fan.
+  std::errc write_fan_duty(const EcFan& fan, uint8_t raw_duty);
+
+  const EcBackendStats& stats() const { return stats_; }
+
+  /// Holds \p lock around every operation; null disables locking. The lock
+  /// must outlive the backend.
+  void set_lock(EcLock* lock) { lock_ = lock; }
+
+protected:
+  virtual std::errc do_read(size_t reg, std::span<uint8_t> out)           = 0;
+  virtual std::errc do_write(size_t reg, uint8_t value)                   = 0;
+  virtual std::errc do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) = 0;
+
+private:
+  template <typename F>
+  std::errc record(size_t transactions, F&& op);
+
+  static bool in_bounds(size_t reg, size_t count) {
+    return reg + count <= k::ec_reg_size;
+  }
+
+  EcBackendStats stats_;
+  EcLock*        lock_ = nullptr;
+};
+
+/// Talks to the EC through inb/outb on ports 0x62/0x66 of \p Ports.
+template <typename Ports>
+class BasicPortIoBackend final : public EcBackend {
+public:
+  BasicPortIoBackend() = default;
+  explicit BasicPortIoBackend(Ports ports) : ports_(std::move(ports)) {}
+
+  std::string_view name() const override { return "port"; }
+  std::errc        open() override { return ports_.open(); }
+
+  Ports& ports() { return ports_; }
+
+  /// Wait histograms are process wide unless redirected, e.g. to keep a
+  /// simulated EC's statistics apart.
+  void set_wait_stats(EcWaitStats& stats) { wait_stats_ = &stats; }
+
+protected:
+  std::errc do_read(size_t reg, std::span<uint8_t> out) override {
+    return ec_io_read_range(
+        ports_, *wait_stats_, static_cast<uint8_t>(reg), out.data(), out.size()
+    );
+  }
+
+  std::errc do_write(size_t reg, uint8_t value) override {
+    return ec_io_do(
+        ports_,
+        *wait_stats_,
+        k::ec_sc_write_cmd,
+        static_cast<uint8_t>(reg),
+        value
+    );
+  }
+
+  std::errc do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) override {
+    return ec_io_do(
+        ports_, *wait_stats_, k::ec_fan_duty_cmd, fan.index, raw_duty
+    );
+  }
+
+private:
+  Ports        ports_;
+  EcWaitStats* wait_stats_ = &ec_wait_stats();
+};
+
+using PortIoBackend = BasicPortIoBackend<HwPorts>;
+
+/// Talks to the EC through /sys/kernel/debug/ec/ec0/io.
+///
+/// The kernel runs one EC transaction per byte read, so the file is kept
+/// open and only the requested registers are read. Register writes require
+/// ec_sys to be loaded with write_support=1. The duty register only reports
+/// the fan duty, so the duty is set with the 0x99 port command, taking port
+/// access on the first duty write.
+class DebugfsBackend final : public EcBackend {
+public:
+  static constexpr std::string_view default_path =
+      "/sys/kernel/debug/ec/ec0/io";
+
+  explicit DebugfsBackend(std::string_view path = default_path)
+      : path_(path) {}
+  ~DebugfsBackend() override;
+
+  std::string_view name() const override { return "debugfs"; }
+  std::errc        open() override;
+
+protected:
+  std::errc do_read(size_t reg, std::span<uint8_t> out) override;
+  std::errc do_write(size_t reg, uint8_t value) override;
+  std::errc do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) override;
+
+private:
+  void close_fd();
+
+  std::string path_;
+  int         fd_         = -1;
+  bool        writable_   = false;
+  HwPorts     ports_;
+  bool        ports_open_ = false;
+};
+
+/// Keeps the register file in memory. Used for dry runs and benchmarks.
+class MockEcBackend final : public EcBackend {
+public:
+  std::string_view name() const override { return "mock"; }
+  std::errc        open() override { return std::errc(); }
+
+  EcRegisters regs{};
+
+protected:
+  std::errc do_read(size_t reg, std::span<uint8_t> out) override;
+  std::errc do_write(size_t reg, uint8_t value) override;
+  std::errc do_write_fan_duty(const EcFan& fan, uint8_t raw_duty) override;
+};
+
+std::optional<EcBackendKind> parse_ec_backend_kind(std::string_view name);
+
+std::unique_ptr<EcBackend> make_ec_backend(EcBackendKind kind);
+
+/// Prints the transaction count and latency of \p backend to stderr.
+void print_ec_backend_stats(const EcBackend& backend);
+} // namespace clevo
+
+#endif // CLEVO_EC_BACKEND_H
@@ -0,0 +1,94 @@
+//===- ec_io.cpp - EC port I/O primitives -----------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the hardware handshakes and the wait statistics.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_io.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <string_view>
+
+namespace clevo {
+namespace {
+EcWaitStats global_wait_stats;
+
+// A wedged EC times out on every transaction; a few lines say as much.
+RateLimiter wait_timeout_limiter(std::chrono::seconds(1), 5);
+
+void print_histogram(std::string_view name, const EcWaitHistogram& h) {
+  fmt::print(
+      stderr,
+      "{} wait: {} waits, {} timeouts, max {} ns\n",
+      name,
+      h.count,
+      h.timeouts,
+      h.max.count()
+  );
+  for (size_t i = 0; i < h.buckets.size(); ++i) {
+    if (!h.buckets[i]) continue;
+    fmt::print(
+        stderr,
+        "  [{:>10} ns, {:>10} ns): {}\n",
+        uint64_t(1) << i,
+        uint64_t(1) << (i + 1),
+        h.buckets[i]
+    );
+  }
+}
+} // namespace
+
+void EcWaitHistogram::add(std::chrono::nanoseconds took) {
+  const auto ns     = static_cast<uint64_t>(std::max<int64_t>(took.count(), 1));
+  const auto bucket = std::min<size_t>(
+      static_cast<size_t>(std::bit_width(ns)) - 1, bucket_count - 1
+  );
+  buckets[bucket] += 1;
+  count += 1;
+  max = std::max(max, took);
+  total += took;
+}
+
+EcWaitStats& ec_wait_stats() { return global_wait_stats; }
+
+void log_ec_wait_timeout(
+    uint16_t port, uint8_t data, uint8_t flag, uint8_t value
+) {
+  uint64_t suppressed = 0;
+  if (!wait_timeout_limiter.allow(RateLimiter::clock::now(), suppressed))
+    return;
+  const std::array<LogField, 4> fields{{
+      {"EC_PORT", port},
+      {"EC_DATA", data},
+      {"EC_FLAG", flag},
+      {"EC_VALUE", value},
+  }};
+  logger().log(
+      LogLevel::warning,
+      fields,
+      "wait_ec error on port {:#02x}, data={:#02x}, flag={:#02x}, "
+      "value={:#02x}",
+      port,
+      data,
+      flag,
+      value
+  );
+  if (suppressed)
+    logger().log(
+        LogLevel::warning, "{} similar wait_ec errors suppressed", suppressed
+    );
+}
+
+void print_ec_wait_stats(const EcWaitStats& stats) {
+  print_histogram("IBF", stats.ibf);
+  print_histogram("OBF", stats.obf);
+}
+} // namespace clevo
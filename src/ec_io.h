@@ -0,0 +1,202 @@
+//===- ec_io.h - EC port I/O primitives -------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Register map and raw port I/O handshakes for the Clevo embedded controller.
+///
+/// The handshakes are templates over a port accessor providing inb, outb and
+/// open, so the same protocol code drives the hardware (HwPorts) and the
+/// simulated EC used by the benchmarks.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EC_IO_H
+#define CLEVO_EC_IO_H
+
+#include <fmt/core.h>
+#include <sys/io.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+namespace clevo {
+namespace k {
+constexpr uint16_t ec_data         = 0x62;
+constexpr uint16_t ec_sc           = 0x66;
+constexpr uint16_t ec_sc_read_cmd  = 0x80;
+constexpr uint16_t ec_sc_write_cmd = 0x81;
+constexpr uint8_t  ec_fan_duty_cmd = 0x99;
+
+constexpr size_t ec_reg_size            = 0x100;
+constexpr size_t ec_reg_cpu_temp        = 0x07;
+constexpr size_t ec_reg_gpu_temp        = 0xCD;
+constexpr size_t ec_reg_fan_duty        = 0xCE;
+constexpr size_t ec_reg_gpu_fan_duty    = 0xCF;
+constexpr size_t ec_reg_fan_rpms_hi     = 0xD0;
+constexpr size_t ec_reg_fan_rpms_lo     = 0xD1;
+constexpr size_t ec_reg_gpu_fan_rpms_hi = 0xD2;
+constexpr size_t ec_reg_gpu_fan_rpms_lo = 0xD3;
+
+constexpr uint8_t ibf = 0x01;
+constexpr uint8_t obf = 0x00;
+
+/// ec_io_wait spins with pause until ec_wait_spin, yields until
+/// ec_wait_yield, then sleeps ec_wait_sleep between polls until
+/// ec_wait_timeout has elapsed.
+constexpr std::chrono::microseconds ec_wait_spin{20};
+constexpr std::chrono::microseconds ec_wait_yield{200};
+constexpr std::chrono::microseconds ec_wait_sleep{50};
+constexpr std::chrono::microseconds ec_wait_timeout{5000};
+} // namespace k
+
+/// Log2 histogram of wait durations: bucket i counts waits that took
+/// [2^i, 2^(i+1)) nanoseconds.
+struct EcWaitHistogram {
+  static constexpr size_t bucket_count = 32;
+
+  std::array<uint64_t, bucket_count> buckets{};
+  uint64_t                           count    = 0;
+  uint64_t                           timeouts = 0;
+  std::chrono::nanoseconds           max{0};
+  std::chrono::nanoseconds           total{0};
+
+  void add(std::chrono::nanoseconds took);
+};
+
+/// Wait histograms for the input (IBF) and output (OBF) buffer flags.
+struct EcWaitStats {
+  EcWaitHistogram ibf;
+  EcWaitHistogram obf;
+};
+
+/// The EC ports of the running machine.
+struct HwPorts {
+  /// Requests access to the EC data and command/status ports.
+  std::errc open() {
+    if (auto err = ioperm(k::ec_data, 1, 1)) return std::errc(err);
+    if (auto err = ioperm(k::ec_sc, 1, 1)) return std::errc(err);
+    return std::errc();
+  }
+
+  uint8_t inb(uint16_t port) { return ::inb(port); }
+  void    outb(uint8_t value, uint16_t port) { ::outb(value, port); }
+};
+
+/// Queues a rate limited warning for a timed out wait; never blocks.
+void log_ec_wait_timeout(
+    uint16_t port, uint8_t data, uint8_t flag, uint8_t value
+);
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/// Polls \p port until bit \p flag equals \p value, or returns
+/// std::errc::timed_out after k::ec_wait_timeout.
+template <typename Ports>
+std::errc ec_io_wait(
+    Ports&         ports,
+    EcWaitStats&   stats,
+    const uint16_t port,
+    const uint8_t  flag,
+    const uint8_t  value
+) {
+  auto& hist = flag == k::ibf ? stats.ibf : stats.obf;
+
+  // The EC usually answers within a few microseconds, so spin first, then
+  // yield, and only fall back to sleeping (which costs 50us+ of timer slack)
+  // for slow controllers.
+  const auto start = std::chrono::steady_clock::now();
+  while (true) {
+    uint8_t data = ports.inb(port);
+    if (((data >> flag) & 0x1) == value) break;
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed >= k::ec_wait_timeout) {
+      hist.timeouts += 1;
+      log_ec_wait_timeout(port, data, flag, value);
+      return std::errc::timed_out;
+    }
+    if (elapsed < k::ec_wait_spin) cpu_relax();
+    else if (elapsed < k::ec_wait_yield) std::this_thread::yield();
+    else std::this_thread::sleep_for(k::ec_wait_sleep);
+  }
+  hist.add(std::chrono::steady_clock::now() - start);
+  return std::errc();
+}
+
+/// Issues the three byte command sequence \p cmd, \p port, \p value.
+template <typename Ports>
+std::errc ec_io_do(
+    Ports&        ports,
+    EcWaitStats&  stats,
+    const uint8_t cmd,
+    const uint8_t port,
+    const uint8_t value
+) {
+  if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0); int(err))
+    return err;
+  ports.outb(cmd, k::ec_sc);
+
+  if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0); int(err))
+    return err;
+  ports.outb(port, k::ec_data);
+
+  if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0); int(err))
+    return err;
+  ports.outb(value, k::ec_data);
+
+  return ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0);
+}
+
+/// Reads \p count consecutive registers starting at \p first into \p out,
+/// issuing each read handshake right after the previous data byte arrives.
+template <typename Ports>
+std::errc ec_io_read_range(
+    Ports&        ports,
+    EcWaitStats&  stats,
+    const uint8_t first,
+    uint8_t*      out,
+    size_t        count
+) {
+  for (size_t i = 0; i < count; ++i) {
+    if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0); int(err))
+      return err;
+    ports.outb(k::ec_sc_read_cmd, k::ec_sc);
+
+    if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::ibf, 0); int(err))
+      return err;
+    ports.outb(static_cast<uint8_t>(first + i), k::ec_data);
+
+    if (auto err = ec_io_wait(ports, stats, k::ec_sc, k::obf, 1); int(err))
+      return err;
+    out[i] = ports.inb(k::ec_data);
+  }
+  return std::errc();
+}
+
+/// Reads EC register \p port into \p value.
+template <typename Ports>
+std::errc ec_io_read(
+    Ports& ports, EcWaitStats& stats, const uint8_t port, uint8_t& value
+) {
+  return ec_io_read_range(ports, stats, port, &value, 1);
+}
+
+/// Wait statistics accumulated by the hardware handshakes since startup.
+EcWaitStats& ec_wait_stats();
+
+/// Prints the non-empty buckets of the wait histograms to stderr.
+void print_ec_wait_stats(const EcWaitStats& stats = ec_wait_stats());
+} // namespace clevo
+
+#endif // CLEVO_EC_IO_H
@@ -0,0 +1,56 @@
+//===- ec_lock.cpp - Cross-process EC lock ----------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the flock() based EC lock.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_lock.h"
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+
+#include <cerrno>
+#include <string>
+
+namespace clevo {
+std::errc EcLock::open(std::string_view path) {
+  const std::string file(path);
+  UniqueFd fd(
+      ::open(file.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)
+  );
+  if (!fd.valid()) return std::errc(errno);
+  struct stat st;
+  if (fstat(fd.get(), &st) < 0) return std::errc(errno);
+  if (!S_ISREG(st.st_mode)) return std::errc::invalid_argument;
+  fd_ = std::move(fd);
+  return std::errc();
+}
+
+std::errc EcLock::acquire(std::chrono::nanoseconds& waited) {
+  waited = std::chrono::nanoseconds(0);
+  // The uncontended case costs one syscall and no clock reads.
+  if (flock(fd_.get(), LOCK_EX | LOCK_NB) == 0) return std::errc();
+  if (errno != EWOULDBLOCK) return std::errc(errno);
+
+  const auto start = std::chrono::steady_clock::now();
+  while (flock(fd_.get(), LOCK_EX) != 0)
+    if (errno != EINTR) return std::errc(errno);
+  waited = std::chrono::steady_clock::now() - start;
+  return std::errc();
+}
+
+std::errc EcLock::try_acquire() {
+  while (flock(fd_.get(), LOCK_EX | LOCK_NB) != 0)
+    if (errno != EINTR) return std::errc(errno);
+  return std::errc();
+}
+
+void EcLock::release() { flock(fd_.get(), LOCK_UN); }
+} // namespace clevo
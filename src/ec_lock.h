@@ -0,0 +1,53 @@
+//===- ec_lock.h - Cross-process EC lock ------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// An advisory flock() on a well-known file, taken by every instance of the
+/// tool around each EC backend operation so the command/data sequences of
+/// two processes never interleave on ports 0x62/0x66. A second file is held
+/// by the -1 worker for its whole run, so a second worker fails to start
+/// instead of interleaving its duty writes with the first.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EC_LOCK_H
+#define CLEVO_EC_LOCK_H
+
+#include "event_loop.h"
+
+#include <chrono>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+class EcLock {
+public:
+  static constexpr std::string_view default_path = "/run/clevo-fancontrol.lock";
+  /// Appended to the EC lock path for the lock held by the worker.
+  static constexpr std::string_view worker_suffix = ".worker";
+
+  /// Opens or creates the lock file \p path, which must be a regular file
+  /// and not a symlink.
+  std::errc open(std::string_view path = default_path);
+
+  bool is_open() const { return fd_.valid(); }
+
+  /// Blocks until the lock is held. \p waited is the time spent blocked
+  /// behind another process, zero when the lock was free.
+  std::errc acquire(std::chrono::nanoseconds& waited);
+
+  /// Takes the lock without blocking; fails with
+  /// resource_unavailable_try_again while another process holds it.
+  std::errc try_acquire();
+
+  void release();
+
+private:
+  UniqueFd fd_;
+};
+} // namespace clevo
+
+#endif // CLEVO_EC_LOCK_H
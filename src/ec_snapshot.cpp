@@ -0,0 +1,90 @@
+//===- ec_snapshot.cpp - Decoded EC register snapshot -----------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the batched snapshot read and register decoding.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_snapshot.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace clevo {
+int32_t calculate_fan_duty(int32_t raw_duty) {
+  return static_cast<int32_t>(static_cast<double>(raw_duty) / 255.0 * 100.0);
+}
+
+uint8_t calculate_raw_fan_duty(int32_t duty_percentage) {
+  return static_cast<uint8_t>(
+      static_cast<double>(duty_percentage) / 100.0 * 255.0
+  );
+}
+
+int32_t calculate_fan_rpms(
+    int32_t raw_rpm_high, int32_t raw_rpm_low, int32_t rpm_constant
+) {
+  int32_t raw_rpm = (raw_rpm_high << 8) + raw_rpm_low;
+  return raw_rpm > 0 ? (rpm_constant / raw_rpm) : 0;
+}
+
+std::errc
+ec_reread_torn_rpms(EcBackend& backend, const EcFan& fan, EcRegisters& raw) {
+  // The EC may update the counter between the high and low byte. A changed
+  // high byte means the low byte belongs to the other value; retry the pair.
+  for (int attempt = 0; attempt < 3; ++attempt) {
+    uint8_t hi = 0;
+    if (auto err = backend.read(fan.rpms_hi_reg, std::span(&hi, 1)); int(err))
+      return err;
+    if (hi == raw[fan.rpms_hi_reg]) break;
+    raw[fan.rpms_hi_reg] = hi;
+    if (auto err = backend.read(
+            fan.rpms_lo_reg, std::span(raw).subspan(fan.rpms_lo_reg, 1)
+        );
+        int(err))
+      return err;
+  }
+  return std::errc();
+}
+
+std::errc ec_read_snapshot(EcBackend& backend, EcSnapshot& snap) {
+  return ec_read_snapshot(backend, ec_single_fan_layout, snap);
+}
+
+std::string format_snapshot_json(const EcSnapshot& snap) {
+  std::string fans;
+  if (snap.fan_count > 1) {
+    fans = "  \"fans\": [\n";
+    for (size_t i = 0; i < snap.fan_count; ++i)
+      fmt::format_to(
+          std::back_inserter(fans),
+          "    {{\"name\": \"{}\", \"duty\": {}, \"rpms\": {}}}{}\n",
+          snap.fans[i].name,
+          snap.fans[i].duty,
+          snap.fans[i].rpms,
+          i + 1 < snap.fan_count ? "," : ""
+      );
+    fans += "  ],\n";
+  }
+  return fmt::format(
+      "{{\n"
+      "  \"duty\": {},\n"
+      "  \"rpms\": {},\n"
+      "  \"cpu_temp_cels\": {},\n"
+      "  \"gpu_temp_cels\": {},\n"
+      "{}"
+      "}}\n",
+      snap.duty,
+      snap.rpms,
+      snap.cpu_temp,
+      snap.gpu_temp,
+      fans
+  );
+}
+} // namespace clevo
@@ -0,0 +1,150 @@
+//===- ec_snapshot.h - Decoded EC register snapshot -------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Reads every register the tool reports in one batch and decodes them.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EC_SNAPSHOT_H
+#define CLEVO_EC_SNAPSHOT_H
+
+#include "ec_backend.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+int32_t calculate_fan_duty(int32_t raw_duty);
+
+/// Converts a duty percentage into the raw 0-255 value the EC stores.
+uint8_t calculate_raw_fan_duty(int32_t duty_percentage);
+
+/// Whether raw duties \p a and \p b decode to the same percentage; the
+/// 0-100 to 0-255 conversion is lossy, so the byte read back after a write
+/// is compared through the decoded value.
+inline bool same_fan_duty(uint8_t a, uint8_t b) {
+  return calculate_fan_duty(a) == calculate_fan_duty(b);
+}
+
+/// RPM = ec_rpm_constant / tachometer period on the boards seen so far.
+constexpr int32_t ec_rpm_constant = 2156220;
+
+int32_t calculate_fan_rpms(
+    int32_t raw_rpm_high,
+    int32_t raw_rpm_low,
+    int32_t rpm_constant = ec_rpm_constant
+);
+
+/// Most fans a snapshot holds.
+constexpr size_t ec_max_fans = 2;
+
+struct EcFanReading {
+  std::string_view name;
+  int32_t          duty = 0;
+  int32_t          rpms = 0;
+};
+
+struct EcSnapshot {
+  int32_t                               cpu_temp  = 0;
+  int32_t                               gpu_temp  = 0;
+  int32_t                               duty      = 0; ///< of fans[0]
+  int32_t                               rpms      = 0; ///< of fans[0]
+  std::array<EcFanReading, ec_max_fans> fans      = {};
+  size_t                                fan_count = 0;
+  EcRegisters                           raw{};
+};
+
+/// The fans of a chassis and its RPM constant, together with the coalesced
+/// ranges covering both temperatures and every fan register. Constant
+/// layouts are computed at compile time.
+class EcSnapshotLayout {
+public:
+  /// Keeps at most ec_max_fans of \p fans, which must outlive the layout.
+  constexpr explicit EcSnapshotLayout(
+      std::span<const EcFan> fans, int32_t rpm_constant = ec_rpm_constant
+  )
+      : fans_(fans.first(std::min(fans.size(), ec_max_fans))),
+        rpm_constant_(rpm_constant) {
+    std::array<size_t, max_regs> regs{};
+    size_t                       n = 0;
+    regs[n++]                      = k::ec_reg_cpu_temp;
+    regs[n++]                      = k::ec_reg_gpu_temp;
+    for (const EcFan& fan : fans_) {
+      regs[n++] = fan.duty_reg;
+      regs[n++] = fan.rpms_hi_reg;
+      regs[n++] = fan.rpms_lo_reg;
+    }
+    range_count_ = coalesce_ec_registers(std::span(regs).first(n), ranges_);
+  }
+
+  constexpr std::span<const EcFan> fans() const { return fans_; }
+  constexpr std::span<const EcRange> ranges() const {
+    return std::span(ranges_).first(range_count_);
+  }
+  constexpr int32_t rpm_constant() const { return rpm_constant_; }
+
+private:
+  static constexpr size_t max_regs = 2 + 3 * ec_max_fans;
+
+  std::span<const EcFan>           fans_;
+  std::array<EcRange, max_regs>    ranges_{};
+  size_t                           range_count_ = 0;
+  int32_t                          rpm_constant_;
+};
+
+constexpr EcSnapshotLayout ec_single_fan_layout{ec_single_fan};
+
+static_assert(ec_single_fan_layout.ranges().size() == 2);
+
+/// Reads the RPM pair of \p fan into \p raw again while its high byte keeps
+/// changing, so the 16 bit value never tears.
+std::errc
+ec_reread_torn_rpms(EcBackend& backend, const EcFan& fan, EcRegisters& raw);
+
+/// Reads every register of \p layout in one batch and decodes them into
+/// \p snap. Inline, so the registers of a constant layout fold into the
+/// caller.
+inline std::errc ec_read_snapshot(
+    EcBackend& backend, const EcSnapshotLayout& layout, EcSnapshot& snap
+) {
+  auto& raw = snap.raw;
+  if (auto err = backend.read_ranges(layout.ranges(), raw); int(err))
+    return err;
+
+  snap.cpu_temp  = raw[k::ec_reg_cpu_temp];
+  snap.gpu_temp  = raw[k::ec_reg_gpu_temp];
+  snap.fan_count = layout.fans().size();
+  for (size_t i = 0; i < snap.fan_count; ++i) {
+    const EcFan& fan = layout.fans()[i];
+    if (auto err = ec_reread_torn_rpms(backend, fan, raw); int(err))
+      return err;
+    snap.fans[i] = {
+        .name = fan.name,
+        .duty = calculate_fan_duty(raw[fan.duty_reg]),
+        .rpms = calculate_fan_rpms(
+            raw[fan.rpms_hi_reg], raw[fan.rpms_lo_reg], layout.rpm_constant()
+        ),
+    };
+  }
+  snap.duty = snap.fans[0].duty;
+  snap.rpms = snap.fans[0].rpms;
+  return std::errc();
+}
+
+/// Reads a snapshot of ec_single_fan_layout.
+std::errc ec_read_snapshot(EcBackend& backend, EcSnapshot& snap);
+
+/// Formats \p snap as the pretty printed JSON object dump_fan prints.
+std::string format_snapshot_json(const EcSnapshot& snap);
+} // namespace clevo
+
+#endif // CLEVO_EC_SNAPSHOT_H
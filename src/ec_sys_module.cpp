@@ -0,0 +1,104 @@
+//===- ec_sys_module.cpp - Loading of the ec_sys kernel module --*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the ec_sys lookup in modules.dep and the finit_module call.
+///
+//===----------------------------------------------------------------------===//
+
+#include "ec_sys_module.h"
+
+#include "event_loop.h"
+
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <string_view>
+
+#ifndef MODULE_INIT_COMPRESSED_FILE
+#define MODULE_INIT_COMPRESSED_FILE 4
+#endif
+
+namespace clevo {
+namespace {
+constexpr std::string_view sys_module = "/sys/module/ec_sys";
+
+bool read_write_support() {
+  char     value = 'N';
+  UniqueFd fd(::open(
+      "/sys/module/ec_sys/parameters/write_support", O_RDONLY | O_CLOEXEC
+  ));
+  if (fd.valid() && ::read(fd.get(), &value, 1) != 1) value = 'N';
+  return value == 'Y' || value == 'y' || value == '1';
+}
+
+/// Finds the ec_sys module file through modules.dep, which lists every
+/// module of the running kernel relative to its /lib/modules directory.
+std::errc find_ec_sys(std::string& path) {
+  utsname uts;
+  if (uname(&uts) != 0) return std::errc(errno);
+  const std::string dir = fmt::format("/lib/modules/{}/", uts.release);
+
+  std::ifstream dep(dir + "modules.dep");
+  if (!dep) return std::errc::no_such_file_or_directory;
+  for (std::string line; std::getline(dep, line);) {
+    const std::string_view file = std::string_view(line).substr(
+        0, std::min(line.find(':'), line.size())
+    );
+    const size_t slash = file.rfind('/');
+    const auto   base  = file.substr(slash == file.npos ? 0 : slash + 1);
+    if (base == "ec_sys.ko" || base.starts_with("ec_sys.ko.")) {
+      path = dir + std::string(file);
+      return std::errc();
+    }
+  }
+  return std::errc::no_such_file_or_directory;
+}
+} // namespace
+
+std::errc ensure_ec_sys_module(bool write_support, EcSysModule& module) {
+  module = {};
+  if (access(sys_module.data(), F_OK) == 0) {
+    module.present       = true;
+    module.write_support = read_write_support();
+    return std::errc();
+  }
+
+  if (auto err = find_ec_sys(module.path); int(err)) return err;
+  UniqueFd fd(::open(module.path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (!fd.valid()) return std::errc(errno);
+
+  // Compressed modules are decompressed by the kernel itself.
+  const unsigned flags =
+      module.path.ends_with(".ko") ? 0u : unsigned(MODULE_INIT_COMPRESSED_FILE);
+  const char* params = write_support ? "write_support=1" : "";
+  const bool loaded = syscall(SYS_finit_module, fd.get(), params, flags) == 0;
+  if (!loaded && errno != EEXIST) return std::errc(errno);
+
+  module.present       = true;
+  module.loaded_now    = loaded;
+  module.write_support = read_write_support();
+  return std::errc();
+}
+
+void print_ec_sys_module(const EcSysModule& module) {
+  if (!module.present) {
+    fmt::print("ec_sys: not loaded\n");
+    return;
+  }
+  if (module.loaded_now) fmt::print("ec_sys: loaded from {}", module.path);
+  else fmt::print("ec_sys: already loaded");
+  if (module.write_support) fmt::print(", writable\n");
+  else fmt::print(", read-only (write_support=1 is not set)\n");
+}
+} // namespace clevo
@@ -0,0 +1,36 @@
+//===- ec_sys_module.h - Loading of the ec_sys kernel module ----*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Checks for and loads the ec_sys module the debugfs backend reads through,
+/// without forking a shell and modprobe.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EC_SYS_MODULE_H
+#define CLEVO_EC_SYS_MODULE_H
+
+#include <string>
+#include <system_error>
+
+namespace clevo {
+struct EcSysModule {
+  bool        present       = false; ///< /sys/module/ec_sys exists
+  bool        loaded_now    = false; ///< loaded by ensure_ec_sys_module
+  bool        write_support = false; ///< parameters/write_support is Y
+  std::string path;                  ///< module file, when loaded now
+};
+
+/// Looks for ec_sys under /sys/module and, when missing, loads it from
+/// /lib/modules/`uname -r` with finit_module, passing write_support=1 if
+/// \p write_support is set. Fills \p module either way.
+std::errc ensure_ec_sys_module(bool write_support, EcSysModule& module);
+
+/// Prints whether ec_sys is present and writable, and how it got there.
+void print_ec_sys_module(const EcSysModule& module);
+} // namespace clevo
+
+#endif // CLEVO_EC_SYS_MODULE_H
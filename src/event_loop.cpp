@@ -0,0 +1,163 @@
+//===- event_loop.cpp - epoll based event loop ------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the epoll loop, timerfd and signalfd wrappers.
+///
+//===----------------------------------------------------------------------===//
+
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+
+namespace clevo {
+UniqueFd& UniqueFd::operator=(UniqueFd&& other) noexcept {
+  reset(other.release());
+  return *this;
+}
+
+void UniqueFd::reset(int fd) {
+  if (fd_ >= 0) close(fd_);
+  fd_ = fd;
+}
+
+//===----------------------------------------------------------------------===//
+// EventLoop
+//===----------------------------------------------------------------------===//
+
+std::errc EventLoop::open() {
+  epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+  return epoll_fd_.valid() ? std::errc() : std::errc(errno);
+}
+
+std::errc EventLoop::add(int fd, uint32_t events, Callback callback) {
+  epoll_event ev{};
+  ev.events  = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &ev) < 0)
+    return std::errc(errno);
+  callbacks_[fd] = std::make_shared<Callback>(std::move(callback));
+  return std::errc();
+}
+
+void EventLoop::remove(int fd) {
+  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_DEL, fd, nullptr);
+  callbacks_.erase(fd);
+}
+
+std::errc EventLoop::run_once(int timeout_ms) {
+  std::array<epoll_event, 16> events;
+  int ready = epoll_wait(
+      epoll_fd_.get(), events.data(), int(events.size()), timeout_ms
+  );
+  if (ready < 0) return errno == EINTR ? std::errc() : std::errc(errno);
+
+  for (int i = 0; i < ready; ++i) {
+    // An earlier callback of this batch may have removed the fd; holding a
+    // reference keeps a callback alive while it removes itself.
+    auto it = callbacks_.find(events[size_t(i)].data.fd);
+    if (it == callbacks_.end()) continue;
+    auto callback = it->second;
+    (*callback)(events[size_t(i)].events);
+  }
+  return std::errc();
+}
+
+//===----------------------------------------------------------------------===//
+// Timer
+//===----------------------------------------------------------------------===//
+
+std::errc Timer::open() {
+  fd_.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+  return fd_.valid() ? std::errc() : std::errc(errno);
+}
+
+std::errc Timer::arm_at(time_point deadline) {
+  // steady_clock is CLOCK_MONOTONIC on Linux, so its epoch matches timerfd's.
+  const auto ns = std::chrono::nanoseconds(deadline.time_since_epoch()).count();
+  itimerspec spec{};
+  spec.it_value.tv_sec  = ns / 1'000'000'000;
+  spec.it_value.tv_nsec = ns % 1'000'000'000;
+  // A zero it_value would disarm the timer; fire immediately instead.
+  if (ns <= 0) spec.it_value.tv_nsec = 1;
+  if (timerfd_settime(fd_.get(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    return std::errc(errno);
+  return std::errc();
+}
+
+uint64_t Timer::drain() {
+  uint64_t expirations = 0;
+  if (::read(fd_.get(), &expirations, sizeof(expirations)) < 0) return 0;
+  return expirations;
+}
+
+//===----------------------------------------------------------------------===//
+// ClockWatch
+//===----------------------------------------------------------------------===//
+
+std::chrono::nanoseconds suspended_time() {
+  auto ns = [](clockid_t clock) {
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return std::chrono::seconds(ts.tv_sec) +
+           std::chrono::nanoseconds(ts.tv_nsec);
+  };
+  return ns(CLOCK_BOOTTIME) - ns(CLOCK_MONOTONIC);
+}
+
+std::errc ClockWatch::open() {
+  fd_.reset(timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC));
+  if (!fd_.valid()) return std::errc(errno);
+  return rearm();
+}
+
+std::errc ClockWatch::rearm() {
+  // Fails with ECANCELED after a clock change; either way it is consumed.
+  uint64_t expirations;
+  if (::read(fd_.get(), &expirations, sizeof(expirations)) < 0 &&
+      errno != ECANCELED && errno != EAGAIN)
+    return std::errc(errno);
+
+  // Only the cancellation matters; the expiry is a year away.
+  timespec now{};
+  clock_gettime(CLOCK_REALTIME, &now);
+  itimerspec spec{};
+  spec.it_value.tv_sec = now.tv_sec + 365 * 24 * 3600;
+  if (timerfd_settime(
+          fd_.get(), TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr
+      ) < 0)
+    return std::errc(errno);
+  return std::errc();
+}
+
+//===----------------------------------------------------------------------===//
+// SignalFd
+//===----------------------------------------------------------------------===//
+
+std::errc SignalFd::open(std::initializer_list<int> signals) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (int sig : signals) sigaddset(&mask, sig);
+  if (sigprocmask(SIG_BLOCK, &mask, nullptr) < 0) return std::errc(errno);
+  fd_.reset(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+  return fd_.valid() ? std::errc() : std::errc(errno);
+}
+
+int SignalFd::read() {
+  signalfd_siginfo info{};
+  if (::read(fd_.get(), &info, sizeof(info)) != sizeof(info)) return 0;
+  return static_cast<int>(info.ssi_signo);
+}
+} // namespace clevo
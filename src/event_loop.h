@@ -0,0 +1,117 @@
+//===- event_loop.h - epoll based event loop --------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// A small epoll event loop with timerfd and signalfd wrappers. The worker
+/// runs every source (sampling timer, termination signals, sockets) on one
+/// thread, so no EC access ever happens inside a signal handler.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_EVENT_LOOP_H
+#define CLEVO_EVENT_LOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+namespace clevo {
+/// Owns a file descriptor and closes it on destruction.
+class UniqueFd {
+public:
+  UniqueFd() = default;
+  explicit UniqueFd(int fd) : fd_(fd) {}
+  UniqueFd(UniqueFd&& other) noexcept : fd_(other.release()) {}
+  UniqueFd& operator=(UniqueFd&& other) noexcept;
+  ~UniqueFd() { reset(); }
+
+  int  get() const { return fd_; }
+  bool valid() const { return fd_ >= 0; }
+  int  release() { return std::exchange(fd_, -1); }
+  void reset(int fd = -1);
+
+private:
+  int fd_ = -1;
+};
+
+class EventLoop {
+public:
+  using Callback = std::function<void(uint32_t events)>;
+
+  std::errc open();
+
+  /// Registers \p fd for \p events (EPOLLIN, ...). \p callback runs on the
+  /// loop thread with the returned event mask.
+  std::errc add(int fd, uint32_t events, Callback callback);
+
+  /// Unregisters \p fd. Safe to call from inside any callback.
+  void remove(int fd);
+
+  /// Waits up to \p timeout_ms (-1 blocks) and dispatches ready callbacks.
+  std::errc run_once(int timeout_ms = -1);
+
+private:
+  UniqueFd                                            epoll_fd_;
+  std::unordered_map<int, std::shared_ptr<Callback>> callbacks_;
+};
+
+/// CLOCK_MONOTONIC timerfd armed with absolute deadlines, so periodic work
+/// scheduled as "previous deadline + period" never drifts.
+class Timer {
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+
+  std::errc open();
+  int       fd() const { return fd_.get(); }
+
+  std::errc arm_at(time_point deadline);
+
+  /// Consumes the expiration count so the fd stops polling readable.
+  uint64_t drain();
+
+private:
+  UniqueFd fd_;
+};
+
+/// Time the system has spent suspended since boot: CLOCK_BOOTTIME keeps
+/// counting through suspend, CLOCK_MONOTONIC does not.
+std::chrono::nanoseconds suspended_time();
+
+/// A CLOCK_REALTIME timerfd armed with TFD_TIMER_CANCEL_ON_SET. The kernel
+/// cancels it, making the fd readable, whenever the wall clock is set and
+/// on every resume from suspend.
+class ClockWatch {
+public:
+  std::errc open();
+  int       fd() const { return fd_.get(); }
+
+  /// Consumes the event and arms the timer again.
+  std::errc rearm();
+
+private:
+  UniqueFd fd_;
+};
+
+/// Blocks \p signals for the process and delivers them through a signalfd.
+class SignalFd {
+public:
+  std::errc open(std::initializer_list<int> signals);
+  int       fd() const { return fd_.get(); }
+
+  /// Returns the next pending signal number, or 0 if none is pending.
+  int read();
+
+private:
+  UniqueFd fd_;
+};
+} // namespace clevo
+
+#endif // CLEVO_EVENT_LOOP_H
@@ -0,0 +1,73 @@
+//===- fan_curve.cpp - Table driven fan curve -------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the automatic duty decision and parses runtime fan curves.
+///
+//===----------------------------------------------------------------------===//
+
+#include "fan_curve.h"
+
+#include <fmt/format.h>
+
+#include <charconv>
+#include <iterator>
+
+namespace clevo {
+int32_t ec_auto_duty_adjust(
+    const FanCurve& curve, int32_t cpu_temp, int32_t gpu_temp, int32_t fan_duty
+) {
+  return curve.decide(std::max(cpu_temp, gpu_temp), fan_duty);
+}
+
+std::errc parse_fan_curve(
+    std::string_view         spec,
+    FanCurve&                curve,
+    std::span<const int32_t> allowed_duties
+) {
+  std::array<CurvePoint, FanCurve::max_points> points{};
+  size_t                                       count = 0;
+
+  while (!spec.empty()) {
+    if (count == points.size()) return std::errc::argument_list_too_long;
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    std::array<int32_t, 3> fields{};
+    for (size_t f = 0; f < fields.size(); ++f) {
+      auto res = std::from_chars(item.begin(), item.end(), fields[f]);
+      if (res.ec != std::errc()) return std::errc::invalid_argument;
+      item.remove_prefix(size_t(res.ptr - item.begin()));
+      const bool last = f + 1 == fields.size();
+      if (last ? !item.empty() : !item.starts_with(':'))
+        return std::errc::invalid_argument;
+      if (!last) item.remove_prefix(1);
+    }
+    points[count++] = {fields[0], fields[1], fields[2]};
+  }
+
+  FanCurve parsed(std::span(points.data(), count), allowed_duties);
+  if (!parsed.valid()) return std::errc::invalid_argument;
+  curve = parsed;
+  return std::errc();
+}
+
+std::string format_fan_curve(const FanCurve& curve) {
+  std::string spec;
+  for (const CurvePoint& p : curve.points())
+    fmt::format_to(
+        std::back_inserter(spec),
+        "{}{}:{}:{}",
+        spec.empty() ? "" : ",",
+        p.temp,
+        p.duty,
+        p.hysteresis
+    );
+  return spec;
+}
+} // namespace clevo
@@ -0,0 +1,217 @@
+//===- fan_curve.h - Table driven fan curve ---------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Describes the automatic fan curve as data and compiles it into a flat
+/// lookup table indexed by temperature and current duty band, so each
+/// decision of the worker is a single table lookup. A curve fixed at build
+/// time compiles into a constexpr table; a curve parsed at runtime goes
+/// through the same builder and yields the same table.
+///
+/// A curve is a list of points (temperature, duty, hysteresis) with ascending
+/// temperatures and duties. For temperature t and current duty d:
+///   1. the highest point with t >= temp and d < duty raises the duty to it;
+///   2. otherwise, t <= temp - hysteresis of the first point turns the fan
+///      off;
+///   3. otherwise, the lowest point whose duty is <= d and where t is at or
+///      below the release temperature of the next point (temp - hysteresis)
+///      lowers the duty to it. The last point releases at its own
+///      temperature;
+///   4. otherwise the duty is left alone (-1).
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_FAN_CURVE_H
+#define CLEVO_FAN_CURVE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+struct CurvePoint {
+  int32_t temp;
+  int32_t duty;
+  int32_t hysteresis;
+};
+
+class FanCurve {
+public:
+  static constexpr size_t temp_count = 256;
+  static constexpr size_t duty_count = 101;
+  static constexpr size_t max_points = 8;
+  static constexpr size_t band_count = max_points + 1;
+
+  /// Duties the EC is known to report back for its own steps. A reported duty
+  /// within 1% of one of them is treated as that step.
+  static constexpr std::array<int32_t, 7> default_allowed_duties = {
+      0, 16, 30, 40, 65, 90, 100
+  };
+
+  constexpr FanCurve() = default;
+
+  constexpr explicit FanCurve(
+      std::span<const CurvePoint> points,
+      std::span<const int32_t>    allowed_duties = default_allowed_duties
+  ) {
+    size_ = std::min(points.size(), max_points);
+    std::copy_n(points.begin(), size_, points_.begin());
+
+    for (size_t d = 0; d < duty_count; ++d) {
+      const int32_t duty = snap_to_allowed(int32_t(d), allowed_duties);
+      band_of_[d] = static_cast<uint8_t>(std::ranges::count_if(
+          std::span(points_.data(), size_),
+          [&](const CurvePoint& p) { return p.duty <= duty; }
+      ));
+    }
+    for (size_t t = 0; t < temp_count; ++t)
+      for (size_t b = 0; b <= size_; ++b)
+        table_[t][b] = static_cast<int8_t>(evaluate(int32_t(t), band_duty(b)));
+  }
+
+  /// Checks the ordering and ranges described in the file comment.
+  constexpr bool valid() const {
+    if (size_ == 0) return false;
+    for (size_t i = 0; i < size_; ++i) {
+      const auto& p = points_[i];
+      if (p.temp < 0 || p.temp >= int32_t(temp_count) || p.duty <= 0 ||
+          p.duty > 100 || p.hysteresis < 0 || p.hysteresis > p.temp)
+        return false;
+      if (i && (p.temp <= points_[i - 1].temp || p.duty <= points_[i - 1].duty))
+        return false;
+    }
+    return true;
+  }
+
+  /// Returns the duty to command, or -1 to leave the current one alone.
+  constexpr int32_t decide(int32_t temp, int32_t duty) const {
+    const auto t = size_t(std::clamp<int32_t>(temp, 0, temp_count - 1));
+    return table_[t][band_of_[size_t(std::clamp<int32_t>(duty, 0, 100))]];
+  }
+
+  constexpr std::span<const CurvePoint> points() const {
+    return {points_.data(), size_};
+  }
+
+  /// Every temperature at which a decision can change: each point's
+  /// engage and release temperature.
+  constexpr size_t thresholds(std::span<int32_t, 2 * max_points> out) const {
+    size_t n = 0;
+    for (const auto& p : points()) {
+      out[n++] = p.temp;
+      out[n++] = p.temp - p.hysteresis;
+    }
+    return n;
+  }
+
+private:
+  static constexpr int32_t
+  snap_to_allowed(int32_t duty, std::span<const int32_t> allowed) {
+    constexpr int32_t range = 1;
+    for (int32_t d : allowed) {
+      const int32_t min_right = d ? d - range : d;
+      const int32_t max_right = d ? d + range : d;
+      if (duty >= min_right && duty <= max_right) return d;
+    }
+    return duty;
+  }
+
+  /// A duty that falls into band \p b: below the first point for 0, else the
+  /// duty of point b - 1.
+  constexpr int32_t band_duty(size_t b) const {
+    return b ? points_[b - 1].duty : 0;
+  }
+
+  constexpr int32_t evaluate(int32_t t, int32_t duty) const {
+    for (size_t i = size_; i-- > 0;)
+      if (t >= points_[i].temp && duty < points_[i].duty)
+        return points_[i].duty;
+    if (t <= points_[0].temp - points_[0].hysteresis) return 0;
+    for (size_t i = 0; i < size_; ++i) {
+      const auto&   next    = points_[std::min(i + 1, size_ - 1)];
+      const int32_t release =
+          i + 1 < size_ ? next.temp - next.hysteresis : points_[i].temp;
+      if (t <= release && duty >= points_[i].duty) return points_[i].duty;
+    }
+    return -1;
+  }
+
+  std::array<CurvePoint, max_points>                     points_{};
+  size_t                                                 size_ = 0;
+  std::array<uint8_t, duty_count>                        band_of_{};
+  std::array<std::array<int8_t, band_count>, temp_count> table_{};
+};
+
+/// The curve tuned for the pang11: 17% from 55°C, 30% from 65°C, 40% from
+/// 75°C and 65% from 85°C, each released 5°C below where it engages.
+constexpr std::array<CurvePoint, 4> default_curve_points = {{
+    {55, 17, 5},
+    {65, 30, 5},
+    {75, 40, 5},
+    {85, 65, 5},
+}};
+
+constexpr FanCurve default_fan_curve{default_curve_points};
+
+static_assert(default_fan_curve.valid());
+static_assert(default_fan_curve.decide(90, 30) == 65);
+static_assert(default_fan_curve.decide(50, 40) == 0);
+static_assert(default_fan_curve.decide(68, 40) == 30);
+static_assert(default_fan_curve.decide(72, 30) == -1);
+static_assert(default_fan_curve.decide(84, 100) == 65);
+
+/// One step of the automatic curve, shared by the worker and the simulator.
+struct CurveDecision {
+  int32_t duty    = -1;    ///< duty to command, -1 to leave it alone
+  bool    floored = false; ///< raised to the feed-forward floor
+};
+
+/// Decides for \p temp while the fan runs at (or ramps to) \p current, given
+/// the previous decision \p last and the feed-forward duty \p floor, which
+/// wins over a lower or unchanged decision.
+constexpr CurveDecision decide_curve_step(
+    const FanCurve& curve,
+    int32_t         temp,
+    int32_t         current,
+    int32_t         last,
+    int32_t         floor = 0
+) {
+  CurveDecision step;
+  step.duty    = curve.decide(temp, current);
+  step.floored = floor > (step.duty < 0 ? current : step.duty);
+  if (step.floored) step.duty = floor;
+  if (step.duty == last) step.duty = -1;
+  return step;
+}
+
+static_assert(decide_curve_step(default_fan_curve, 90, 30, -1).duty == 65);
+static_assert(decide_curve_step(default_fan_curve, 90, 30, 65).duty == -1);
+static_assert(decide_curve_step(default_fan_curve, 72, 30, 30, 40).floored);
+
+/// Decides the duty for the hottest of \p cpu_temp and \p gpu_temp. Returns
+/// -1 to leave the duty alone; DutyRamp spreads the change over time.
+int32_t ec_auto_duty_adjust(
+    const FanCurve& curve, int32_t cpu_temp, int32_t gpu_temp, int32_t fan_duty
+);
+
+/// Parses "temp:duty:hysteresis,..." into \p curve, snapping reported duties
+/// to \p allowed_duties.
+std::errc parse_fan_curve(
+    std::string_view         spec,
+    FanCurve&                curve,
+    std::span<const int32_t> allowed_duties = FanCurve::default_allowed_duties
+);
+
+/// Formats the points of \p curve the way parse_fan_curve reads them.
+std::string format_fan_curve(const FanCurve& curve);
+} // namespace clevo
+
+#endif // CLEVO_FAN_CURVE_H
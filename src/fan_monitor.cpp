@@ -0,0 +1,84 @@
+//===- fan_monitor.cpp - RPM filter and stall detection ---------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the filters and the stall state.
+///
+//===----------------------------------------------------------------------===//
+
+#include "fan_monitor.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+
+namespace clevo {
+std::errc parse_fan_monitor_params(
+    std::string_view spec, FanMonitorParams& params
+) {
+  FanMonitorParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    if (key == "filter") {
+      if (value == "median") parsed.filter = RpmFilter::median;
+      else if (value == "ema") parsed.filter = RpmFilter::ema;
+      else return std::errc::invalid_argument;
+      continue;
+    }
+
+    double v;
+    auto   res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end() || v < 0)
+      return std::errc::invalid_argument;
+
+    if (key == "window") parsed.window = size_t(v);
+    else if (key == "alpha") parsed.alpha = v;
+    else if (key == "ticks") parsed.ticks = int32_t(v);
+    else if (key == "duty") parsed.duty = int32_t(v);
+    else return std::errc::invalid_argument;
+  }
+  if (parsed.window == 0 || parsed.window > FanMonitor::max_window ||
+      parsed.alpha <= 0 || parsed.alpha > 1 || parsed.ticks == 0 ||
+      parsed.duty > 100)
+    return std::errc::invalid_argument;
+  params = parsed;
+  return std::errc();
+}
+
+void FanMonitor::update(int32_t duty, int32_t rpms) {
+  was_stalled_ = stalled();
+  readings_.push(rpms);
+
+  if (params_.filter == RpmFilter::ema) {
+    ema_ = readings_.size() == 1
+               ? rpms
+               : ema_ + params_.alpha * (double(rpms) - ema_);
+    filtered_ = static_cast<int32_t>(std::lround(ema_));
+  } else {
+    std::array<int32_t, max_window> window;
+    const size_t                    n =
+        std::min(params_.window, readings_.size());
+    for (size_t i = 0; i < n; ++i) window[i] = readings_.recent(i);
+    const auto mid = window.begin() + ptrdiff_t(n / 2);
+    std::nth_element(window.begin(), mid, window.begin() + ptrdiff_t(n));
+    filtered_ = window[n / 2];
+  }
+
+  // Look at the raw reading: the filters would hide a stop for a few ticks.
+  if (duty > 0 && rpms == 0)
+    zero_ticks_ = std::min(zero_ticks_ + 1, params_.ticks);
+  else zero_ticks_ = 0;
+  if (stall_began()) ++stalls_;
+}
+} // namespace clevo
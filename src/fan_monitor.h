@@ -0,0 +1,103 @@
+//===- fan_monitor.h - RPM filter and stall detection -----------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Smooths the tachometer readings of a fan and notices when it stops
+/// spinning while driven. A reading is one tachometer period decoded to
+/// RPM, which jitters by a few percent from tick to tick; the last readings
+/// are kept in a fixed ring, so monitoring never allocates.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_FAN_MONITOR_H
+#define CLEVO_FAN_MONITOR_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+/// The last N values pushed, oldest overwritten first.
+template <typename T, size_t N>
+class RingBuffer {
+public:
+  static constexpr size_t capacity = N;
+
+  constexpr void push(T value) {
+    values_[head_] = value;
+    head_          = (head_ + 1) % N;
+    size_          = std::min(size_ + 1, N);
+  }
+
+  constexpr size_t size() const { return size_; }
+  constexpr bool   empty() const { return size_ == 0; }
+  constexpr void   clear() { head_ = size_ = 0; }
+
+  /// The \p i th most recent value, 0 being the last pushed.
+  constexpr T recent(size_t i) const {
+    return values_[(head_ + N - 1 - i) % N];
+  }
+
+private:
+  std::array<T, N> values_{};
+  size_t           head_ = 0;
+  size_t           size_ = 0;
+};
+
+enum class RpmFilter { median, ema };
+
+struct FanMonitorParams {
+  RpmFilter filter = RpmFilter::median;
+  size_t    window = 5;   ///< readings of the median, up to 16
+  double    alpha  = 0.3; ///< weight of a new reading in the EMA
+  int32_t   ticks  = 8;   ///< zero RPM samples at a non-zero duty to stall
+  int32_t   duty   = 100; ///< duty forced while stalled
+};
+
+/// Parses "key=value,..." with the keys filter (median or ema), window,
+/// alpha, ticks and duty on top of the defaults in \p params.
+std::errc parse_fan_monitor_params(
+    std::string_view spec, FanMonitorParams& params
+);
+
+class FanMonitor {
+public:
+  static constexpr size_t max_window = 16;
+
+  FanMonitor() = default;
+  explicit FanMonitor(const FanMonitorParams& params) : params_(params) {}
+
+  /// Feeds the duty and RPM the EC reported in one sample.
+  void update(int32_t duty, int32_t rpms);
+
+  /// Median or EMA of the recent readings.
+  int32_t filtered() const { return filtered_; }
+
+  bool stalled() const { return zero_ticks_ >= params_.ticks; }
+
+  /// Whether the last update started or ended a stall.
+  bool stall_began() const { return stalled() && !was_stalled_; }
+  bool stall_ended() const { return !stalled() && was_stalled_; }
+
+  uint64_t stalls() const { return stalls_; }
+
+  const FanMonitorParams& params() const { return params_; }
+
+private:
+  FanMonitorParams                params_;
+  RingBuffer<int32_t, max_window> readings_;
+  double                          ema_         = 0.0;
+  int32_t                         filtered_    = 0;
+  int32_t                         zero_ticks_  = 0;
+  bool                            was_stalled_ = false;
+  uint64_t                        stalls_      = 0;
+};
+} // namespace clevo
+
+#endif // CLEVO_FAN_MONITOR_H
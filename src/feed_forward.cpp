@@ -0,0 +1,181 @@
+//===- feed_forward.cpp - Power and load feed-forward -----------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the RAPL and /proc/stat load sensors and the boost logic.
+///
+//===----------------------------------------------------------------------===//
+
+#include "feed_forward.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+namespace clevo {
+namespace {
+constexpr std::string_view powercap_dir = "/sys/class/powercap";
+constexpr std::string_view proc_stat    = "/proc/stat";
+
+/// Finds the energy counter of the first package zone, e.g.
+/// intel-rapl:0 named "package-0".
+std::optional<std::string> find_package_zone() {
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(powercap_dir, ec)) {
+    const std::string zone = entry.path().filename();
+    if (!zone.starts_with("intel-rapl:") ||
+        zone.find(':') != zone.rfind(':'))
+      continue;
+    std::string   name;
+    std::ifstream file(entry.path() / "name");
+    if (std::getline(file, name) && name.starts_with("package"))
+      return entry.path().string();
+  }
+  return std::nullopt;
+}
+
+uint64_t read_file_u64(const std::string& path) {
+  uint64_t      value = 0;
+  std::ifstream file(path);
+  file >> value;
+  return value;
+}
+} // namespace
+
+std::errc parse_feed_forward_params(
+    std::string_view spec, FeedForwardParams& params
+) {
+  FeedForwardParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    if (key == "source") {
+      if (value == "auto") parsed.source = LoadSource::automatic;
+      else if (value == "rapl") parsed.source = LoadSource::rapl;
+      else if (value == "stat") parsed.source = LoadSource::proc_stat;
+      else return std::errc::invalid_argument;
+      continue;
+    }
+
+    double v;
+    auto   res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end() || v < 0)
+      return std::errc::invalid_argument;
+
+    if (key == "watts" && v > 0) parsed.watts = v;
+    else if (key == "jump" && v <= 1) parsed.jump = v;
+    else if (key == "level" && v <= 1) parsed.level = v;
+    else if (key == "duty" && v <= 100)
+      parsed.duty = static_cast<int32_t>(std::lround(v));
+    else if (key == "hold")
+      parsed.hold = std::chrono::milliseconds(std::lround(v));
+    else return std::errc::invalid_argument;
+  }
+  params = parsed;
+  return std::errc();
+}
+
+std::errc LoadSensor::open(LoadSource source, double full_scale_watts) {
+  watts_ = full_scale_watts;
+  last_value_.reset();
+
+  if (source != LoadSource::proc_stat) {
+    if (auto zone = find_package_zone()) {
+      path_       = *zone + "/energy_uj";
+      max_energy_ = read_file_u64(*zone + "/max_energy_range_uj");
+      fd_.reset(::open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+      if (fd_.valid()) return source_ = LoadSource::rapl, std::errc();
+    }
+    if (source == LoadSource::rapl) return std::errc::no_such_file_or_directory;
+  }
+
+  path_ = proc_stat;
+  fd_.reset(::open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+  if (!fd_.valid()) return std::errc(errno);
+  source_ = LoadSource::proc_stat;
+  return std::errc();
+}
+
+std::errc LoadSensor::read_counter(uint64_t& value, uint64_t& idle) {
+  // Only the first line of /proc/stat is needed: the aggregate "cpu" jiffies.
+  std::array<char, 256> buf;
+  const ssize_t         len = pread(fd_.get(), buf.data(), buf.size() - 1, 0);
+  if (len <= 0) return len < 0 ? std::errc(errno) : std::errc::io_error;
+  std::string_view text(buf.data(), size_t(len));
+
+  if (source_ == LoadSource::rapl) {
+    auto res = std::from_chars(text.begin(), text.end(), value);
+    return res.ec;
+  }
+
+  if (!text.starts_with("cpu ")) return std::errc::io_error;
+  text.remove_prefix(4);
+  // user nice system idle iowait irq softirq steal; guest time is already
+  // part of user.
+  value = idle = 0;
+  for (int field = 0; field < 8; ++field) {
+    while (text.starts_with(' ')) text.remove_prefix(1);
+    uint64_t jiffies = 0;
+    auto     res     = std::from_chars(text.begin(), text.end(), jiffies);
+    if (res.ec != std::errc()) return std::errc::io_error;
+    text.remove_prefix(size_t(res.ptr - text.begin()));
+    value += jiffies;
+    if (field == 3 || field == 4) idle += jiffies;
+  }
+  return std::errc();
+}
+
+std::errc LoadSensor::read(time_point now, double& load) {
+  uint64_t value = 0, idle = 0;
+  if (auto err = read_counter(value, idle); int(err)) return err;
+
+  load = 0.0;
+  if (last_value_) {
+    if (source_ == LoadSource::rapl) {
+      // The counter wraps at max_energy_range_uj.
+      uint64_t delta = value >= *last_value_
+                           ? value - *last_value_
+                           : value + max_energy_ - *last_value_;
+      const double dt = std::chrono::duration<double>(now - last_time_).count();
+      if (dt > 0) load = double(delta) / 1e6 / dt / watts_;
+    } else if (value > *last_value_) {
+      const uint64_t total = value - *last_value_;
+      const uint64_t idled = std::min(idle - last_idle_, total);
+      load                 = double(total - idled) / double(total);
+    }
+  }
+  load        = std::clamp(load, 0.0, 1.0);
+  last_value_ = value;
+  last_idle_  = idle;
+  last_time_  = now;
+  return std::errc();
+}
+
+int32_t FeedForward::update(double load, time_point now) {
+  jumped_ = load >= params_.level && load - last_load_ >= params_.jump;
+  // A boost in progress is extended for as long as the load stays high.
+  if (jumped_ || (boost_until_ && load >= params_.level))
+    boost_until_ = now + params_.hold;
+  last_load_ = load;
+  if (boost_until_ && now >= *boost_until_) boost_until_.reset();
+  return boost_until_ ? params_.duty : 0;
+}
+} // namespace clevo
@@ -0,0 +1,99 @@
+//===- feed_forward.h - Power and load feed-forward -------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Raises the fan duty as soon as package power or CPU load jumps, before
+/// the EC temperatures, which trail the heat-up by seconds, cross a curve
+/// threshold.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_FEED_FORWARD_H
+#define CLEVO_FEED_FORWARD_H
+
+#include "event_loop.h"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+/// Where the load comes from. auto prefers RAPL and falls back to /proc/stat.
+enum class LoadSource { automatic, rapl, proc_stat };
+
+struct FeedForwardParams {
+  LoadSource source = LoadSource::automatic;
+  double     watts  = 25.0; ///< package power counted as full load
+  double     jump   = 0.25; ///< load rise within one sample that boosts
+  double     level  = 0.5;  ///< load that must be reached to boost
+  int32_t    duty   = 40;   ///< duty floor while boosting
+  std::chrono::milliseconds hold{10000}; ///< boost time once load drops
+};
+
+/// Parses "key=value,..." with the keys source (auto, rapl or stat), watts,
+/// jump, level, duty and hold (ms) on top of the defaults in \p params.
+std::errc parse_feed_forward_params(
+    std::string_view spec, FeedForwardParams& params
+);
+
+/// Measures load between consecutive reads through a file descriptor kept
+/// open for the lifetime of the sensor.
+class LoadSensor {
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /// Opens the package energy counter under /sys/class/powercap, which the
+  /// intel-rapl driver also exposes for AMD Zen, or /proc/stat.
+  std::errc open(LoadSource source, double full_scale_watts);
+
+  /// Returns the load since the previous read in [0, 1]; the first read
+  /// returns 0.
+  std::errc read(time_point now, double& load);
+
+  LoadSource         source() const { return source_; }
+  const std::string& path() const { return path_; }
+
+private:
+  std::errc read_counter(uint64_t& value, uint64_t& idle);
+
+  UniqueFd                  fd_;
+  LoadSource                source_ = LoadSource::automatic;
+  std::string               path_;
+  double                    watts_      = 1.0;
+  uint64_t                  max_energy_ = 0;
+  std::optional<uint64_t>   last_value_;
+  uint64_t                  last_idle_ = 0;
+  time_point                last_time_{};
+};
+
+/// Turns load samples into a duty floor held for a while after each jump.
+class FeedForward {
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+
+  explicit FeedForward(const FeedForwardParams& params) : params_(params) {}
+
+  /// Feeds \p load measured at \p now and returns the duty floor, 0 when not
+  /// boosting.
+  int32_t update(double load, time_point now);
+
+  /// Whether the last update started a boost.
+  bool jumped() const { return jumped_; }
+
+  const FeedForwardParams& params() const { return params_; }
+
+private:
+  FeedForwardParams         params_;
+  double                    last_load_ = 0.0;
+  bool                      jumped_    = false;
+  std::optional<time_point> boost_until_;
+};
+} // namespace clevo
+
+#endif // CLEVO_FEED_FORWARD_H
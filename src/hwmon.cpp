@@ -0,0 +1,150 @@
+//===- hwmon.cpp - hwmon temperature sensors --------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements hwmon discovery, the millidegree reads and the fusion filter.
+///
+//===----------------------------------------------------------------------===//
+
+#include "hwmon.h"
+
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <span>
+
+namespace clevo {
+namespace {
+struct DriverPreference {
+  std::string_view driver;
+  bool             cpu;
+  /// Labels in order of preference; temp1 when none matches.
+  std::array<std::string_view, 2> labels;
+};
+
+constexpr std::array<DriverPreference, 6> drivers = {{
+    {"k10temp", true, {"Tctl", "Tdie"}},
+    {"zenpower", true, {"Tdie", "Tctl"}},
+    {"coretemp", true, {"Package id 0", ""}},
+    {"amdgpu", false, {"edge", "junction"}},
+    {"radeon", false, {"", ""}},
+    {"nouveau", false, {"", ""}},
+}};
+
+std::string read_line(const std::filesystem::path& path) {
+  std::string   line;
+  std::ifstream file(path);
+  std::getline(file, line);
+  return line;
+}
+
+/// Picks the temp*_input of \p dir whose label ranks best for \p pref.
+std::optional<HwmonSensor>
+open_input(const std::filesystem::path& dir, const DriverPreference& pref) {
+  std::string best = "temp1";
+  size_t      rank = pref.labels.size();
+  for (int i = 1; i <= 16; ++i) {
+    const std::string temp  = fmt::format("temp{}", i);
+    const std::string label = read_line(dir / fmt::format("{}_label", temp));
+    for (size_t r = 0; r < rank; ++r)
+      if (!pref.labels[r].empty() && label == pref.labels[r])
+        best = temp, rank = r;
+  }
+
+  HwmonSensor sensor;
+  sensor.path = (dir / fmt::format("{}_input", best)).string();
+  sensor.fd.reset(::open(sensor.path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (!sensor.fd.valid()) return std::nullopt;
+  sensor.name = std::string(pref.driver);
+  if (rank < pref.labels.size())
+    sensor.name.append(" ").append(pref.labels[rank]);
+  return sensor;
+}
+} // namespace
+
+std::errc parse_fusion_params(std::string_view spec, FusionParams& params) {
+  FusionParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    if (key == "mode") {
+      if (value == "max") parsed.mode = FusionMode::max;
+      else if (value == "weighted") parsed.mode = FusionMode::weighted;
+      else return std::errc::invalid_argument;
+    } else if (key == "weight") {
+      double v;
+      auto   res = std::from_chars(value.begin(), value.end(), v);
+      if (res.ec != std::errc() || res.ptr != value.end() || v < 0 || v > 1)
+        return std::errc::invalid_argument;
+      parsed.weight = v;
+    } else {
+      return std::errc::invalid_argument;
+    }
+  }
+  params = parsed;
+  return std::errc();
+}
+
+double fuse_temperature(
+    double ec, std::optional<double> hwmon, const FusionParams& params
+) {
+  if (!hwmon) return ec;
+  if (params.mode == FusionMode::max) return std::max(ec, *hwmon);
+  return params.weight * *hwmon + (1.0 - params.weight) * ec;
+}
+
+std::errc HwmonSensor::read(double& celsius) const {
+  std::array<char, 32> buf;
+  const ssize_t        len = pread(fd.get(), buf.data(), buf.size(), 0);
+  if (len <= 0) return len < 0 ? std::errc(errno) : std::errc::io_error;
+  int64_t millidegrees = 0;
+  auto res = std::from_chars(buf.data(), buf.data() + len, millidegrees);
+  if (res.ec != std::errc()) return res.ec;
+  celsius = double(millidegrees) / 1000.0;
+  return std::errc();
+}
+
+std::errc HwmonSensors::open(std::string_view root) {
+  cpu_.reset(), gpu_.reset();
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(root, ec)) {
+    const std::string name = read_line(entry.path() / "name");
+    for (const DriverPreference& pref : drivers) {
+      auto& slot = pref.cpu ? cpu_ : gpu_;
+      if (name != pref.driver || slot) continue;
+      slot = open_input(entry.path(), pref);
+    }
+  }
+  if (!cpu_ && !gpu_) return std::errc::no_such_device;
+  return std::errc();
+}
+
+void HwmonSensors::read() {
+  auto read_one = [](const std::optional<HwmonSensor>& sensor,
+                     std::optional<double>&            temp) {
+    double celsius = 0.0;
+    if (sensor && !int(sensor->read(celsius))) temp = celsius;
+    else temp.reset();
+  };
+  read_one(cpu_, cpu_temp_);
+  read_one(gpu_, gpu_temp_);
+}
+} // namespace clevo
@@ -0,0 +1,73 @@
+//===- hwmon.h - hwmon temperature sensors ----------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Millidegree CPU and GPU temperatures from the kernel's hwmon drivers,
+/// fused with the whole-degree EC readings into the controller input.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_HWMON_H
+#define CLEVO_HWMON_H
+
+#include "event_loop.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+enum class FusionMode { max, weighted };
+
+struct FusionParams {
+  FusionMode mode   = FusionMode::max;
+  double     weight = 0.7; ///< share of the hwmon reading in weighted mode
+};
+
+/// Parses "key=value,..." with the keys mode (max or weighted) and weight on
+/// top of the defaults in \p params.
+std::errc parse_fusion_params(std::string_view spec, FusionParams& params);
+
+/// Combines EC reading \p ec with hwmon reading \p hwmon, if there is one.
+double fuse_temperature(
+    double ec, std::optional<double> hwmon, const FusionParams& params
+);
+
+/// One temp*_input file, kept open and re-read with pread.
+struct HwmonSensor {
+  std::string name; ///< driver name and label, e.g. "k10temp Tctl"
+  std::string path;
+  UniqueFd    fd;
+
+  /// Reads the temperature in °C.
+  std::errc read(double& celsius) const;
+};
+
+/// The CPU and GPU sensors found under /sys/class/hwmon: k10temp, zenpower
+/// or coretemp for the CPU, amdgpu, radeon or nouveau for the GPU.
+class HwmonSensors {
+public:
+  static constexpr std::string_view default_root = "/sys/class/hwmon";
+
+  /// Opens the preferred input of each kind. Fails when neither is found.
+  std::errc open(std::string_view root = default_root);
+
+  /// Reads both sensors; a failed read clears that reading.
+  void read();
+
+  const std::optional<HwmonSensor>& cpu_sensor() const { return cpu_; }
+  const std::optional<HwmonSensor>& gpu_sensor() const { return gpu_; }
+  std::optional<double>             cpu() const { return cpu_temp_; }
+  std::optional<double>             gpu() const { return gpu_temp_; }
+
+private:
+  std::optional<HwmonSensor> cpu_, gpu_;
+  std::optional<double>      cpu_temp_, gpu_temp_;
+};
+} // namespace clevo
+
+#endif // CLEVO_HWMON_H
@@ -0,0 +1,133 @@
+//===- logger.cpp - Asynchronous structured logger --------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the background writer and the console and journald sinks.
+///
+//===----------------------------------------------------------------------===//
+
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace clevo {
+namespace {
+constexpr std::string_view journal_socket = "/run/systemd/journal/socket";
+constexpr std::string_view identifier     = "clevo-fancontrol";
+
+UniqueFd connect_journal() {
+  UniqueFd fd(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+  if (!fd.valid()) return fd;
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::copy(journal_socket.begin(), journal_socket.end(), addr.sun_path);
+  if (connect(fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    fd.reset();
+  return fd;
+}
+} // namespace
+
+std::optional<LogSink> parse_log_sink(std::string_view name) {
+  if (name == "auto") return LogSink::automatic;
+  if (name == "console") return LogSink::console;
+  if (name == "journal") return LogSink::journal;
+  return std::nullopt;
+}
+
+Logger& logger() {
+  static Logger instance;
+  return instance;
+}
+
+std::errc Logger::start(LogSink sink) {
+  if (running_) return std::errc();
+  // journald sets JOURNAL_STREAM for services whose stdout it collects;
+  // automatic falls back to stdout when the native socket is unavailable.
+  if (sink != LogSink::console &&
+      (sink == LogSink::journal || std::getenv("JOURNAL_STREAM"))) {
+    journal_fd_ = connect_journal();
+    if (!journal_fd_.valid() && sink == LogSink::journal)
+      return std::errc(errno);
+  }
+  sink_ = journal_fd_.valid() ? LogSink::journal : LogSink::console;
+
+  // Anything printed before must reach stdout before the writer's records.
+  std::fflush(stdout);
+  stop_.store(false);
+  running_ = true;
+  writer_  = std::thread([this] { run(); });
+  return std::errc();
+}
+
+void Logger::stop() {
+  if (!running_) return;
+  stop_.store(true, std::memory_order_release);
+  wake_.fetch_add(1, std::memory_order_release);
+  wake_.notify_one();
+  writer_.join();
+  running_ = false;
+  sink_    = LogSink::console;
+  journal_fd_.reset();
+}
+
+void Logger::run() {
+  while (true) {
+    const uint32_t seen = wake_.load(std::memory_order_acquire);
+    while (const LogRecord* record = queue_.front()) {
+      write(*record);
+      queue_.pop();
+    }
+    if (stop_.load(std::memory_order_acquire)) break;
+    wake_.wait(seen, std::memory_order_acquire);
+  }
+}
+
+void Logger::write(const LogRecord& record) {
+  const std::string_view message(record.text.data(), record.message_size);
+  const std::string_view fields(
+      record.text.data() + record.message_size,
+      record.size - record.message_size
+  );
+  std::array<char, LogRecord::capacity + 128> buf;
+
+  if (sink_ == LogSink::journal) {
+    // Native protocol: one datagram of KEY=value lines. Messages never
+    // contain newlines, which would need the binary length encoding.
+    const auto res = fmt::format_to_n(
+        buf.data(),
+        buf.size(),
+        "PRIORITY={}\nSYSLOG_IDENTIFIER={}\nMESSAGE={}\n{}",
+        int(record.level),
+        identifier,
+        message,
+        fields
+    );
+    const size_t size = std::min(res.size, buf.size());
+    send(journal_fd_.get(), buf.data(), size, MSG_NOSIGNAL);
+    return;
+  }
+
+  const std::chrono::system_clock::time_point time(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::nanoseconds(record.realtime_ns)
+      )
+  );
+  const auto res = fmt::format_to_n(
+      buf.data(), buf.size() - 1, "{:%m/%d %H:%M:%S} - {}", time, message
+  );
+  size_t size = std::min(res.size, buf.size() - 1);
+  buf[size++] = '\n';
+  [[maybe_unused]] const ssize_t n = ::write(STDOUT_FILENO, buf.data(), size);
+}
+} // namespace clevo
@@ -0,0 +1,211 @@
+//===- logger.h - Asynchronous structured logger ----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Log records are formatted with fmt::format_to_n into preallocated slots
+/// of a lock-free single producer, single consumer queue, and written to
+/// stdout or to journald with structured fields by a background thread, so
+/// logging never blocks the worker or an EC transaction.
+///
+/// Only the worker thread may log while the writer runs. Before start() and
+/// after stop() records are written synchronously.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_LOGGER_H
+#define CLEVO_LOGGER_H
+
+#include "event_loop.h"
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace clevo {
+/// syslog priorities, as journald expects them in PRIORITY=.
+enum class LogLevel : uint8_t { error = 3, warning = 4, notice = 5, info = 6 };
+
+enum class LogSink { automatic, console, journal };
+
+std::optional<LogSink> parse_log_sink(std::string_view name);
+
+/// A journald field; \p key must be upper case and outlive the record.
+struct LogField {
+  std::string_view key;
+  int64_t          value;
+};
+
+struct LogRecord {
+  static constexpr size_t capacity = 256;
+
+  int64_t                    realtime_ns  = 0;
+  LogLevel                   level        = LogLevel::info;
+  uint16_t                   message_size = 0; ///< message at the start
+  uint16_t                   size         = 0; ///< message + "KEY=value\n"s
+  std::array<char, capacity> text;
+};
+
+/// Lock-free single producer, single consumer ring of log records.
+class LogQueue {
+public:
+  static constexpr size_t capacity = 256;
+
+  /// Producer: the next free slot, or nullptr when the queue is full.
+  LogRecord* reserve() {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == capacity)
+      return nullptr;
+    return &slots_[head % capacity];
+  }
+
+  /// Producer: publishes the slot returned by reserve().
+  void commit() { head_.fetch_add(1, std::memory_order_release); }
+
+  /// Consumer: the oldest record, or nullptr when empty.
+  const LogRecord* front() const {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) return nullptr;
+    return &slots_[tail % capacity];
+  }
+
+  /// Consumer: releases the record returned by front().
+  void pop() { tail_.fetch_add(1, std::memory_order_release); }
+
+private:
+  std::array<LogRecord, capacity>    slots_;
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+/// Lets \p burst messages through per \p interval and counts the rest.
+class RateLimiter {
+public:
+  using clock = std::chrono::steady_clock;
+
+  RateLimiter(clock::duration interval, uint32_t burst)
+      : interval_(interval), burst_(burst) {}
+
+  /// Whether a message may be logged at \p now. When it may, \p suppressed
+  /// receives the number of messages dropped since the last one logged.
+  bool allow(clock::time_point now, uint64_t& suppressed) {
+    if (now - window_start_ >= interval_) window_start_ = now, passed_ = 0;
+    if (passed_ == burst_) return ++suppressed_, false;
+    ++passed_;
+    suppressed  = suppressed_;
+    suppressed_ = 0;
+    return true;
+  }
+
+private:
+  clock::duration   interval_;
+  uint32_t          burst_;
+  uint32_t          passed_     = 0;
+  uint64_t          suppressed_ = 0;
+  clock::time_point window_start_{};
+};
+
+class Logger {
+public:
+  Logger() = default;
+  ~Logger() { stop(); }
+
+  /// Starts the background writer on \p sink. automatic picks journald when
+  /// stdout is connected to the journal.
+  std::errc start(LogSink sink = LogSink::automatic);
+
+  /// Drains the queue and joins the writer.
+  void stop();
+
+  /// Formats a record and queues it; drops it when the queue is full.
+  template <typename... Args>
+  void log(
+      LogLevel                    level,
+      std::span<const LogField>   fields,
+      fmt::format_string<Args...> format,
+      Args&&... args
+  );
+
+  template <typename... Args>
+  void log(LogLevel level, fmt::format_string<Args...> format, Args&&... args) {
+    log(level, {}, format, std::forward<Args>(args)...);
+  }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  void run();
+  void write(const LogRecord& record);
+
+  LogQueue              queue_;
+  LogRecord             sync_record_;
+  LogSink               sink_ = LogSink::console;
+  UniqueFd              journal_fd_;
+  std::thread           writer_;
+  bool                  running_ = false;
+  std::atomic<bool>     stop_{false};
+  std::atomic<uint32_t> wake_{0}; ///< bumped for every record and for stop()
+  std::atomic<uint64_t> dropped_{0};
+};
+
+/// The process wide logger.
+Logger& logger();
+
+template <typename... Args>
+void Logger::log(
+    LogLevel                    level,
+    std::span<const LogField>   fields,
+    fmt::format_string<Args...> format,
+    Args&&... args
+) {
+  LogRecord* record = running_ ? queue_.reserve() : &sync_record_;
+  if (!record) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  const auto now = std::chrono::system_clock::now().time_since_epoch();
+  record->realtime_ns = std::chrono::nanoseconds(now).count();
+  record->level       = level;
+
+  char*      text = record->text.data();
+  const auto msg  = fmt::format_to_n(
+      text, LogRecord::capacity, format, std::forward<Args>(args)...
+  );
+  size_t size          = std::min(msg.size, LogRecord::capacity);
+  record->message_size = static_cast<uint16_t>(size);
+  // Fields that do not fit are left out rather than truncated.
+  for (const LogField& field : fields) {
+    const size_t room = LogRecord::capacity - size;
+    const auto   res  = fmt::format_to_n(
+        text + size, room, "{}={}\n", field.key, field.value
+    );
+    if (res.size > room) break;
+    size += res.size;
+  }
+  record->size = static_cast<uint16_t>(size);
+
+  if (!running_) {
+    std::fflush(stdout); // keep order with earlier fmt::print output
+    return write(*record);
+  }
+  queue_.commit();
+  wake_.fetch_add(1, std::memory_order_release);
+  wake_.notify_one();
+}
+} // namespace clevo
+
+#endif // CLEVO_LOGGER_H
@@ -0,0 +1,295 @@
+//===- metrics.cpp - Prometheus metrics exporter ----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the text exposition and the minimal HTTP/1.0 responder.
+///
+//===----------------------------------------------------------------------===//
+
+#include "metrics.h"
+
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iterator>
+
+namespace clevo {
+namespace {
+using Out = std::back_insert_iterator<std::string>;
+
+void header(
+    Out out, std::string_view name, std::string_view type, std::string_view help
+) {
+  fmt::format_to(out, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void counter(
+    Out out, std::string_view name, std::string_view help, uint64_t value
+) {
+  header(out, name, "counter", help);
+  fmt::format_to(out, "{} {}\n", name, value);
+}
+
+/// Bucket i of the log2 histograms ends at 2^(i+1) ns; le is in seconds.
+void histogram(
+    Out                    out,
+    std::string_view       name,
+    std::string_view       help,
+    const EcWaitHistogram& hist
+) {
+  header(out, name, "histogram", help);
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < hist.buckets.size(); ++i) {
+    cumulative += hist.buckets[i];
+    fmt::format_to(
+        out,
+        "{}_bucket{{le=\"{:g}\"}} {}\n",
+        name,
+        double(uint64_t(2) << i) * 1e-9,
+        cumulative
+    );
+  }
+  fmt::format_to(
+      out,
+      "{}_bucket{{le=\"+Inf\"}} {}\n{}_sum {:g}\n{}_count {}\n",
+      name,
+      cumulative,
+      name,
+      std::chrono::duration<double>(hist.total).count(),
+      name,
+      cumulative
+  );
+}
+
+bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t len =
+        send(fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (len <= 0) return false;
+    data.remove_prefix(static_cast<size_t>(len));
+  }
+  return true;
+}
+} // namespace
+
+std::string format_metrics(const Metrics& m) {
+  std::string text;
+  text.reserve(8192);
+  Out out(text);
+
+  header(out, "clevo_temperature_celsius", "gauge", "EC temperature.");
+  fmt::format_to(
+      out,
+      "clevo_temperature_celsius{{sensor=\"cpu\"}} {}\n"
+      "clevo_temperature_celsius{{sensor=\"gpu\"}} {}\n",
+      m.cpu_temp,
+      m.gpu_temp
+  );
+  header(out, "clevo_fan_duty_percent", "gauge", "Fan duty the EC reports.");
+  for (size_t i = 0; i < m.fan_count; ++i)
+    fmt::format_to(
+        out,
+        "clevo_fan_duty_percent{{fan=\"{}\"}} {}\n",
+        m.fans[i].name,
+        m.fans[i].duty
+    );
+  header(out, "clevo_fan_rpm", "gauge", "Fan speed.");
+  for (size_t i = 0; i < m.fan_count; ++i)
+    fmt::format_to(
+        out,
+        "clevo_fan_rpm{{fan=\"{}\"}} {}\n",
+        m.fans[i].name,
+        m.fans[i].rpms
+    );
+  header(
+      out,
+      "clevo_fan_rpm_filtered",
+      "gauge",
+      "Fan speed smoothed over the last readings."
+  );
+  for (size_t i = 0; i < m.fan_count; ++i)
+    fmt::format_to(
+        out,
+        "clevo_fan_rpm_filtered{{fan=\"{}\"}} {}\n",
+        m.fans[i].name,
+        m.fans[i].rpms_filtered
+    );
+  header(
+      out,
+      "clevo_fan_stalls_total",
+      "counter",
+      "Times the fan read 0 RPM while driven."
+  );
+  for (size_t i = 0; i < m.fan_count; ++i)
+    fmt::format_to(
+        out,
+        "clevo_fan_stalls_total{{fan=\"{}\"}} {}\n",
+        m.fans[i].name,
+        m.fans[i].stalls
+    );
+
+  counter(
+      out,
+      "clevo_ec_wait_timeouts_total",
+      "Timed out IBF/OBF waits.",
+      m.wait_timeouts
+  );
+  counter(
+      out,
+      "clevo_ec_transactions_total",
+      "EC register transactions.",
+      m.transactions
+  );
+  counter(out, "clevo_ec_errors_total", "Failed EC operations.", m.ec_errors);
+  counter(
+      out,
+      "clevo_ec_short_reads_total",
+      "EC reads that returned too few bytes.",
+      m.short_reads
+  );
+  counter(
+      out,
+      "clevo_duty_writes_issued_total",
+      "Duty writes sent to the EC.",
+      m.writes_issued
+  );
+  counter(
+      out,
+      "clevo_duty_writes_skipped_total",
+      "Duty writes skipped, the EC already had the duty.",
+      m.writes_skipped
+  );
+  counter(
+      out,
+      "clevo_ec_overrides_total",
+      "Times the EC replaced the commanded duty.",
+      m.overrides
+  );
+
+  histogram(
+      out,
+      "clevo_tick_jitter_seconds",
+      "Delay of each sample past its deadline.",
+      m.tick_jitter
+  );
+  histogram(
+      out,
+      "clevo_ec_operation_seconds",
+      "Latency of each EC backend operation.",
+      m.ec_latency
+  );
+  histogram(
+      out,
+      "clevo_ec_lock_wait_seconds",
+      "Time EC operations waited for another process to release the lock.",
+      m.ec_lock_wait
+  );
+  return text;
+}
+
+MetricsServer::~MetricsServer() {
+  for (auto& c : clients_) close_client(c);
+  if (listen_fd_ >= 0) {
+    loop_.remove(listen_fd_);
+    close(listen_fd_);
+  }
+}
+
+std::errc MetricsServer::listen(uint16_t port) {
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) return std::errc(errno);
+
+  const int on = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      ::listen(listen_fd_, 8) < 0)
+    return std::errc(errno);
+  return loop_.add(listen_fd_, EPOLLIN, [this](uint32_t) {
+    accept_clients();
+  });
+}
+
+void MetricsServer::accept_clients() {
+  while (true) {
+    int fd =
+        accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    auto on_ready = [this, fd](uint32_t) { on_client_ready(fd); };
+    if (int(loop_.add(fd, EPOLLIN, on_ready))) {
+      close(fd);
+      continue;
+    }
+    clients_.push_back({fd});
+  }
+}
+
+void MetricsServer::on_client_ready(int fd) {
+  auto it = std::ranges::find(clients_, fd, &Client::fd);
+  if (it == clients_.end()) return;
+  if (!read_client(*it)) close_client(*it);
+  std::erase_if(clients_, [](const Client& c) { return c.fd < 0; });
+}
+
+bool MetricsServer::read_client(Client& client) {
+  char buf[1024];
+  while (true) {
+    ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+    if (len == 0) return false;
+    if (len < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    client.in.append(buf, static_cast<size_t>(len));
+
+    // The headers are not needed, only their end.
+    if (client.in.find("\r\n\r\n") != std::string::npos ||
+        client.in.find("\n\n") != std::string::npos) {
+      const std::string_view in = client.in;
+      reply(client, in.substr(0, in.find_first_of("\r\n")));
+      return false;
+    }
+    if (client.in.size() > 4 * sizeof(buf)) return false;
+  }
+}
+
+void MetricsServer::reply(Client& client, std::string_view request_line) {
+  std::string_view status = "200 OK";
+  std::string      body;
+  if (!request_line.starts_with("GET ")) status = "405 Method Not Allowed";
+  else if (request_line.starts_with("GET /metrics ") ||
+           request_line.starts_with("GET / "))
+    body = format_metrics(metrics_);
+  else status = "404 Not Found";
+
+  // A scrape fits the socket buffer of a local peer; one that does not is
+  // cut short rather than stalling the loop.
+  send_all(
+      client.fd,
+      fmt::format(
+          "HTTP/1.0 {}\r\nContent-Type: text/plain; version=0.0.4\r\n"
+          "Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+          status,
+          body.size(),
+          body
+      )
+  );
+}
+
+void MetricsServer::close_client(Client& client) {
+  loop_.remove(client.fd);
+  close(client.fd);
+  client.fd = -1;
+}
+} // namespace clevo
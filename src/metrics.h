@@ -0,0 +1,89 @@
+//===- metrics.h - Prometheus metrics exporter ------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Control loop health in the Prometheus text exposition format, served
+/// over HTTP on a localhost port. The worker copies its state into Metrics
+/// after every sample and the exporter formats it between two samples, both
+/// on the worker's event loop.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_METRICS_H
+#define CLEVO_METRICS_H
+
+#include "ec_io.h"
+#include "ec_snapshot.h"
+#include "event_loop.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace clevo {
+struct FanMetrics {
+  std::string_view name; ///< set before the exporter starts
+  int32_t          duty          = 0;
+  int32_t          rpms          = 0;
+  int32_t          rpms_filtered = 0;
+  uint64_t         stalls        = 0;
+};
+
+struct Metrics {
+  int32_t                             cpu_temp = 0;
+  int32_t                             gpu_temp = 0;
+  std::array<FanMetrics, ec_max_fans> fans;
+  size_t                              fan_count      = 0;
+  uint64_t                            wait_timeouts  = 0;
+  uint64_t                            transactions   = 0;
+  uint64_t                            ec_errors      = 0;
+  uint64_t                            short_reads    = 0;
+  uint64_t                            writes_issued  = 0;
+  uint64_t                            writes_skipped = 0;
+  uint64_t                            overrides      = 0;
+  EcWaitHistogram                     tick_jitter;
+  EcWaitHistogram                     ec_latency;
+  EcWaitHistogram                     ec_lock_wait;
+};
+
+/// Formats \p metrics in the Prometheus text format, version 0.0.4.
+std::string format_metrics(const Metrics& metrics);
+
+/// Answers every HTTP request with format_metrics() and closes.
+class MetricsServer {
+public:
+  MetricsServer(const Metrics& metrics, EventLoop& loop)
+      : metrics_(metrics), loop_(loop) {}
+  MetricsServer(const MetricsServer&)            = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+  ~MetricsServer();
+
+  /// Listens on 127.0.0.1:\p port and serves from the event loop.
+  std::errc listen(uint16_t port);
+
+private:
+  struct Client {
+    int         fd = -1;
+    std::string in = {};
+  };
+
+  void accept_clients();
+  void on_client_ready(int fd);
+  bool read_client(Client& client);
+  void reply(Client& client, std::string_view request_line);
+  void close_client(Client& client);
+
+  const Metrics&      metrics_;
+  EventLoop&          loop_;
+  int                 listen_fd_ = -1;
+  std::vector<Client> clients_;
+};
+} // namespace clevo
+
+#endif // CLEVO_METRICS_H
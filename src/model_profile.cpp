@@ -0,0 +1,38 @@
+//===- model_profile.cpp - Per model EC profiles ----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements profile lookup by name and by DMI board name.
+///
+//===----------------------------------------------------------------------===//
+
+#include "model_profile.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace clevo {
+const ModelProfile* find_model_profile(std::string_view name) {
+  for (const ModelProfile* profile : model_profiles)
+    if (profile->name == name ||
+        std::ranges::find(profile->board_names, name) !=
+            profile->board_names.end())
+      return profile;
+  return nullptr;
+}
+
+const ModelProfile* detect_model_profile(std::string& board) {
+  std::ifstream file("/sys/class/dmi/id/board_name");
+  if (!std::getline(file, board)) return board.clear(), nullptr;
+  while (!board.empty() && (board.back() == ' ' || board.back() == '\r'))
+    board.pop_back();
+  for (const ModelProfile* profile : model_profiles)
+    if (std::ranges::find(profile->board_names, board) !=
+        profile->board_names.end())
+      return profile;
+  return nullptr;
+}
+} // namespace clevo
@@ -0,0 +1,70 @@
+//===- model_profile.h - Per model EC profiles ------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Compile-time descriptions of the supported boards: fan registers, RPM
+/// constant, the duty steps the EC reports and the default curve. The worker
+/// is instantiated on one profile, so its register offsets are constants.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_MODEL_PROFILE_H
+#define CLEVO_MODEL_PROFILE_H
+
+#include "ec_snapshot.h"
+#include "fan_curve.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace clevo {
+struct ModelProfile {
+  std::string_view                  name;
+  std::span<const std::string_view> board_names; ///< DMI board_name matches
+  EcSnapshotLayout                  layout;
+  std::span<const int32_t>          allowed_duties;
+  FanCurve                          default_curve;
+};
+
+inline constexpr std::array<std::string_view, 1> clevo_boards = {"pang11"};
+
+/// Single fan Clevo boards such as the System76 Pangolin (pang11); also used
+/// when the board is not recognised.
+inline constexpr ModelProfile clevo_profile{
+    .name           = "clevo",
+    .board_names    = clevo_boards,
+    .layout         = EcSnapshotLayout(ec_single_fan, ec_rpm_constant),
+    .allowed_duties = FanCurve::default_allowed_duties,
+    .default_curve  = default_fan_curve,
+};
+
+/// Clevo boards with a discrete GPU and a second fan for it, which follows
+/// the GPU sensor. No board names are known yet, so select it with --model.
+inline constexpr ModelProfile clevo_dgpu_profile{
+    .name           = "clevo-dgpu",
+    .board_names    = {},
+    .layout         = EcSnapshotLayout(ec_dual_fans, ec_rpm_constant),
+    .allowed_duties = FanCurve::default_allowed_duties,
+    .default_curve  = default_fan_curve,
+};
+
+inline constexpr std::array<const ModelProfile*, 2> model_profiles = {
+    &clevo_profile, &clevo_dgpu_profile
+};
+
+/// Returns the profile called \p name or listing it as a board name, so
+/// traces recorded under the board name still resolve; nullptr otherwise.
+const ModelProfile* find_model_profile(std::string_view name);
+
+/// Returns the profile listing /sys/class/dmi/id/board_name, or nullptr.
+/// \p board receives the board name read, if any.
+const ModelProfile* detect_model_profile(std::string& board);
+} // namespace clevo
+
+#endif // CLEVO_MODEL_PROFILE_H
@@ -0,0 +1,109 @@
+//===- pid.cpp - PID setpoint controller ------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the PID control law with anti-windup and slew limiting.
+///
+//===----------------------------------------------------------------------===//
+
+#include "pid.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace clevo {
+std::errc parse_pid_params(std::string_view spec, PidParams& params) {
+  PidParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    double v;
+    auto   res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end())
+      return std::errc::invalid_argument;
+
+    if (key == "setpoint") parsed.setpoint = v;
+    else if (key == "off_below") parsed.off_below = v;
+    else if (key == "kp") parsed.kp = v;
+    else if (key == "ki") parsed.ki = v;
+    else if (key == "kd") parsed.kd = v;
+    else if (key == "slew") parsed.slew = v;
+    else if (key == "min") parsed.min_duty = v;
+    else return std::errc::invalid_argument;
+  }
+  if (parsed.kp < 0 || parsed.ki < 0 || parsed.kd < 0 || parsed.slew <= 0 ||
+      parsed.min_duty < 0 || parsed.min_duty > 100 ||
+      parsed.off_below > parsed.setpoint)
+    return std::errc::invalid_argument;
+  params = parsed;
+  return std::errc();
+}
+
+std::string format_pid_params(const PidParams& params) {
+  return fmt::format(
+      "setpoint={:g},off_below={:g},kp={:g},ki={:g},kd={:g},slew={:g},min={:g}",
+      params.setpoint,
+      params.off_below,
+      params.kp,
+      params.ki,
+      params.kd,
+      params.slew,
+      params.min_duty
+  );
+}
+
+void PidController::reset() {
+  integral_ = 0.0;
+  output_   = 0.0;
+  primed_   = false;
+}
+
+int32_t PidController::update(double temp, double dt) {
+  dt = std::max(dt, 1e-3);
+  double target;
+  if (temp < params_.off_below) {
+    integral_ = 0.0;
+    target    = 0.0;
+  } else {
+    const double error = temp - params_.setpoint;
+    // Derivative on the measurement, so setpoint changes do not kick.
+    const double derivative = primed_ ? (temp - last_temp_) / dt : 0.0;
+    const double unclamped =
+        params_.kp * error + params_.ki * (integral_ + error * dt) +
+        params_.kd * derivative;
+
+    // Conditional integration: stop accumulating while the output is
+    // saturated in the direction the error pushes it.
+    const bool saturated =
+        (unclamped >= 100.0 && error > 0) || (unclamped <= 0.0 && error < 0);
+    if (!saturated) integral_ += error * dt;
+    if (params_.ki > 0) {
+      const double limit = 100.0 / params_.ki;
+      integral_          = std::clamp(integral_, -limit, limit);
+    }
+
+    target = params_.kp * error + params_.ki * integral_ +
+             params_.kd * derivative;
+    target = std::clamp(target, params_.min_duty, 100.0);
+  }
+  primed_    = true;
+  last_temp_ = temp;
+
+  const double step = params_.slew * dt;
+  output_           = std::clamp(target, output_ - step, output_ + step);
+  return static_cast<int32_t>(std::lround(output_));
+}
+} // namespace clevo
@@ -0,0 +1,65 @@
+//===- pid.h - PID setpoint controller --------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Built-in PID controller that holds the hottest sensor at a setpoint and
+/// turns the fan off below a floor temperature.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_PID_H
+#define CLEVO_PID_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+struct PidParams {
+  double setpoint  = 60.0; ///< °C held by the controller
+  double off_below = 50.0; ///< °C below which the fan is turned off
+  double kp        = 4.0;  ///< %/°C
+  double ki        = 0.2;  ///< %/(°C*s)
+  double kd        = 2.0;  ///< %*s/°C
+  double slew      = 10.0; ///< maximum duty change in %/s
+  double min_duty  = 0.0;  ///< lowest duty while the fan runs
+};
+
+/// Parses "key=value,..." with the keys setpoint, off_below, kp, ki, kd,
+/// slew and min on top of the defaults in \p params.
+std::errc parse_pid_params(std::string_view spec, PidParams& params);
+
+/// Formats \p params the way parse_pid_params reads them.
+std::string format_pid_params(const PidParams& params);
+
+class PidController {
+public:
+  explicit PidController(const PidParams& params) : params_(params) {}
+
+  /// Feeds \p temp measured \p dt seconds after the previous update and
+  /// returns the duty to command (0-100).
+  int32_t update(double temp, double dt);
+
+  /// Forgets the integral, derivative and slew history.
+  void reset();
+
+  /// Replaces the gains but keeps the history, so a retune does not bump
+  /// the duty.
+  void set_params(const PidParams& params) { params_ = params; }
+
+  const PidParams& params() const { return params_; }
+
+private:
+  PidParams params_;
+  double    integral_  = 0.0;
+  double    last_temp_ = 0.0;
+  double    output_    = 0.0;
+  bool      primed_    = false;
+};
+} // namespace clevo
+
+#endif // CLEVO_PID_H
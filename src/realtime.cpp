@@ -0,0 +1,90 @@
+//===- realtime.cpp - Real-time mode for the worker -------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the scheduling, affinity and memory locking calls.
+///
+//===----------------------------------------------------------------------===//
+
+#include "realtime.h"
+
+#include <fmt/core.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+
+namespace clevo {
+namespace {
+/// Touches \p bytes of stack below the caller so later calls never fault.
+[[gnu::noinline]] void prefault_stack(size_t bytes) {
+  constexpr size_t page = 4096;
+  if (bytes < page) return;
+  volatile char block[page];
+  block[0] = 0;
+  prefault_stack(bytes - page);
+  block[page - 1] = block[0];
+}
+} // namespace
+
+std::errc parse_realtime_params(std::string_view spec, RealtimeParams& params) {
+  RealtimeParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    int  v;
+    auto res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end() || v < 0)
+      return std::errc::invalid_argument;
+
+    if (key == "prio" && v >= 1 && v <= 99) parsed.priority = v;
+    else if (key == "cpu" && v < CPU_SETSIZE) parsed.cpu = v;
+    else if (key == "stack") parsed.stack_kib = size_t(v);
+    else return std::errc::invalid_argument;
+  }
+  params = parsed;
+  return std::errc();
+}
+
+std::errc enter_realtime(const RealtimeParams& params) {
+  if (params.cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(*params.cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      const int err = errno;
+      fmt::print("unable to pin to CPU {}\n", *params.cpu);
+      return std::errc(err);
+    }
+  }
+
+  sched_param sp{};
+  sp.sched_priority = params.priority;
+  if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp) != 0) {
+    const int err = errno;
+    fmt::print("unable to switch to SCHED_FIFO {}\n", params.priority);
+    return std::errc(err);
+  }
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    const int err = errno;
+    fmt::print("unable to lock memory\n");
+    return std::errc(err);
+  }
+  prefault_stack(params.stack_kib * 1024);
+  return std::errc();
+}
+} // namespace clevo
@@ -0,0 +1,38 @@
+//===- realtime.h - Real-time mode for the worker ---------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Keeps the worker from being preempted or page faulting in the middle of an
+/// EC transaction: SCHED_FIFO at a low priority, a CPU pin, mlockall and a
+/// pre-faulted stack.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_REALTIME_H
+#define CLEVO_REALTIME_H
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+struct RealtimeParams {
+  int                priority  = 1;   ///< SCHED_FIFO priority, 1-99
+  std::optional<int> cpu;             ///< CPU to pin to, none by default
+  size_t             stack_kib = 256; ///< stack pre-faulted after mlockall
+};
+
+/// Parses "key=value,..." with the keys prio, cpu and stack (KiB) on top of
+/// the defaults in \p params.
+std::errc parse_realtime_params(std::string_view spec, RealtimeParams& params);
+
+/// Switches the calling thread to \p params. Stops at the first step that
+/// fails and returns its error.
+std::errc enter_realtime(const RealtimeParams& params);
+} // namespace clevo
+
+#endif // CLEVO_REALTIME_H
@@ -0,0 +1,173 @@
+//===- sample_ring.cpp - Shared memory sample ring --------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the seqlock writer and reader of the sample ring.
+///
+//===----------------------------------------------------------------------===//
+
+#include "sample_ring.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+namespace clevo {
+namespace {
+// Sample fields are copied through atomic_ref so the concurrent reader and
+// writer never race on plain memory; the seqlock then rejects torn copies.
+template <typename F>
+void for_each_field(Sample& dst, Sample& src, F&& f) {
+  f(dst.timestamp_ns, src.timestamp_ns);
+  f(dst.cpu_temp, src.cpu_temp);
+  f(dst.gpu_temp, src.gpu_temp);
+  f(dst.fan_count, src.fan_count);
+  for (size_t i = 0; i < Sample::max_fans; ++i) {
+    f(dst.duty[i], src.duty[i]);
+    f(dst.rpms[i], src.rpms[i]);
+    f(dst.commanded_duty[i], src.commanded_duty[i]);
+  }
+}
+
+void store_sample(Sample& dst, const Sample& src) {
+  for_each_field(dst, const_cast<Sample&>(src), [](auto& to, auto& from) {
+    std::atomic_ref(to).store(from, std::memory_order_relaxed);
+  });
+}
+
+void load_sample(Sample& dst, const Sample& src) {
+  // The mapping is read-only; relaxed atomic loads never write to it.
+  for_each_field(dst, const_cast<Sample&>(src), [](auto& to, auto& from) {
+    to = std::atomic_ref(from).load(std::memory_order_relaxed);
+  });
+}
+
+/// shm_open names must start with a slash; accept "name" and "/name".
+std::string shm_path(std::string_view name) {
+  std::string path(name);
+  if (!name.starts_with('/')) path.insert(path.begin(), '/');
+  return path;
+}
+
+size_t ring_size(uint32_t capacity) {
+  return sizeof(SampleRingHeader) + sizeof(SampleSlot) * capacity;
+}
+} // namespace
+
+SampleRingWriter::~SampleRingWriter() {
+  if (!header_) return;
+  munmap(header_, size_);
+  shm_unlink(name_.c_str());
+}
+
+std::errc SampleRingWriter::open(std::string_view name, uint32_t capacity) {
+  if (capacity == 0) return std::errc::invalid_argument;
+  name_  = shm_path(name);
+  int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return std::errc(errno);
+
+  size_ = ring_size(capacity);
+  if (ftruncate(fd, static_cast<off_t>(size_)) < 0) {
+    int err = errno;
+    close(fd);
+    return std::errc(err);
+  }
+  void* mem = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return std::errc(errno);
+
+  std::memset(mem, 0, size_);
+  header_ = static_cast<SampleRingHeader*>(mem);
+  slots_  = reinterpret_cast<SampleSlot*>(header_ + 1);
+  header_->version   = SampleRingHeader::version_value;
+  header_->capacity  = capacity;
+  header_->slot_size = sizeof(SampleSlot);
+  header_->head.store(0, std::memory_order_relaxed);
+  // Readers check the magic last, so it is only visible once the rest is.
+  std::atomic_ref(header_->magic)
+      .store(SampleRingHeader::magic_value, std::memory_order_release);
+  return std::errc();
+}
+
+void SampleRingWriter::publish(const Sample& sample) {
+  if (!header_) return;
+  const uint64_t head = header_->head.load(std::memory_order_relaxed);
+  SampleSlot&    slot = slots_[head % header_->capacity];
+
+  const uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  store_sample(slot.sample, sample);
+  slot.seq.store(seq + 2, std::memory_order_release);
+  header_->head.store(head + 1, std::memory_order_release);
+}
+
+SampleRingReader::~SampleRingReader() {
+  if (header_) munmap(const_cast<SampleRingHeader*>(header_), size_);
+}
+
+std::errc SampleRingReader::open(std::string_view name) {
+  std::string path = shm_path(name);
+  int         fd = shm_open(path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) return std::errc(errno);
+
+  struct stat st {};
+  if (fstat(fd, &st) < 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(SampleRingHeader)) {
+    close(fd);
+    return std::errc::invalid_argument;
+  }
+  size_     = static_cast<size_t>(st.st_size);
+  void* mem = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return std::errc(errno);
+
+  const auto* header = static_cast<const SampleRingHeader*>(mem);
+  const auto  magic  = std::atomic_ref(const_cast<uint32_t&>(header->magic))
+                          .load(std::memory_order_acquire);
+  if (magic != SampleRingHeader::magic_value ||
+      header->version != SampleRingHeader::version_value ||
+      header->slot_size != sizeof(SampleSlot) ||
+      ring_size(header->capacity) > size_) {
+    munmap(mem, size_);
+    return std::errc::invalid_argument;
+  }
+  header_ = header;
+  slots_  = reinterpret_cast<const SampleSlot*>(header_ + 1);
+  return std::errc();
+}
+
+uint64_t SampleRingReader::head() const {
+  return header_ ? header_->head.load(std::memory_order_acquire) : 0;
+}
+
+bool SampleRingReader::read(uint64_t index, Sample& out) const {
+  if (!header_) return false;
+  const SampleSlot& slot = slots_[index % header_->capacity];
+  for (int attempt = 0; attempt < 16; ++attempt) {
+    const uint64_t before = slot.seq.load(std::memory_order_acquire);
+    if (before & 1) continue;
+    load_sample(out, slot.sample);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != before) continue;
+    // Each publish to a slot advances seq by 2, so the slot holds sample
+    // number (before / 2 - 1) * capacity + slot index.
+    return before / 2 == index / header_->capacity + 1;
+  }
+  return false;
+}
+
+bool SampleRingReader::latest(Sample& out) const {
+  const uint64_t h = head();
+  return h && read(h - 1, out);
+}
+} // namespace clevo
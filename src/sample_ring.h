@@ -0,0 +1,120 @@
+//===- sample_ring.h - Shared memory sample ring ----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Publishes every worker sample, with the duty and RPM of every fan, into a
+/// seqlock protected ring buffer in /dev/shm. Readers mmap the file
+/// read-only and never touch the EC or make a syscall per read. The writer
+/// unlinks the object when it closes; mapped readers keep the last samples.
+///
+/// Layout (native endian, all fields naturally aligned):
+///   SampleRingHeader                            64 bytes
+///   SampleSlot[capacity]                        64 bytes each
+/// header.head counts published samples; the latest one lives in slot
+/// (head - 1) % capacity. A slot is consistent when its seq is even and
+/// unchanged across the read.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_SAMPLE_RING_H
+#define CLEVO_SAMPLE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+struct Sample {
+  static constexpr size_t max_fans = 2;
+
+  int64_t timestamp_ns = 0; ///< CLOCK_REALTIME
+  int32_t cpu_temp     = 0;
+  int32_t gpu_temp     = 0;
+  int32_t fan_count    = 0; ///< fans in the arrays below, in layout order
+  int32_t reserved     = 0;
+  int32_t duty[max_fans]           = {};
+  int32_t rpms[max_fans]           = {};
+  int32_t commanded_duty[max_fans] = {-1, -1}; ///< -1 when left alone
+};
+
+struct SampleRingHeader {
+  static constexpr uint32_t magic_value   = 0x63667331; // "cfs1"
+  static constexpr uint32_t version_value = 2;
+
+  uint32_t              magic;
+  uint32_t              version;
+  uint32_t              capacity;
+  uint32_t              slot_size;
+  std::atomic<uint64_t> head;
+  uint8_t               reserved[40];
+};
+
+struct SampleSlot {
+  std::atomic<uint64_t> seq;
+  Sample                sample;
+  uint8_t               reserved[8];
+};
+
+static_assert(sizeof(SampleRingHeader) == 64);
+static_assert(sizeof(SampleSlot) == 64);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+class SampleRingWriter {
+public:
+  static constexpr std::string_view default_name = "/clevo-fancontrol";
+  static constexpr uint32_t         default_capacity = 256;
+
+  SampleRingWriter() = default;
+  SampleRingWriter(const SampleRingWriter&)            = delete;
+  SampleRingWriter& operator=(const SampleRingWriter&) = delete;
+  ~SampleRingWriter();
+
+  /// Creates (or resets) the shared memory object \p name, unlinked again
+  /// when the writer is destroyed.
+  std::errc open(std::string_view name, uint32_t capacity = default_capacity);
+
+  bool is_open() const { return header_ != nullptr; }
+
+  void publish(const Sample& sample);
+
+private:
+  SampleRingHeader* header_ = nullptr;
+  SampleSlot*       slots_  = nullptr;
+  size_t            size_   = 0;
+  std::string       name_;
+};
+
+class SampleRingReader {
+public:
+  SampleRingReader() = default;
+  SampleRingReader(const SampleRingReader&)            = delete;
+  SampleRingReader& operator=(const SampleRingReader&) = delete;
+  ~SampleRingReader();
+
+  /// Maps \p name read-only.
+  std::errc open(std::string_view name = SampleRingWriter::default_name);
+
+  /// Number of samples published so far.
+  uint64_t head() const;
+
+  /// Copies sample number \p index (0 based, must be < head()). Returns false
+  /// if the writer has already overwritten it.
+  bool read(uint64_t index, Sample& out) const;
+
+  /// Copies the most recent sample; false if none was published yet.
+  bool latest(Sample& out) const;
+
+private:
+  const SampleRingHeader* header_ = nullptr;
+  const SampleSlot*       slots_  = nullptr;
+  size_t                  size_   = 0;
+};
+} // namespace clevo
+
+#endif // CLEVO_SAMPLE_RING_H
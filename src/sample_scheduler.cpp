@@ -0,0 +1,51 @@
+//===- sample_scheduler.cpp - Adaptive sampling period ----------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the slope and threshold driven sampling period.
+///
+//===----------------------------------------------------------------------===//
+
+#include "sample_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace clevo {
+SampleScheduler::SampleScheduler(
+    duration                 min_period,
+    duration                 max_period,
+    std::span<const int32_t> thresholds
+)
+    : min_period_(min_period),
+      max_period_(std::max(min_period, max_period)),
+      period_(min_period),
+      thresholds_(thresholds.begin(), thresholds.end()) {}
+
+SampleScheduler::duration
+SampleScheduler::next_period(int32_t temp, time_point now) {
+  if (primed_) {
+    const double dt = std::chrono::duration<double>(now - last_time_).count();
+    if (dt > 0) {
+      // EC temperatures are whole degrees; smoothing keeps a single step
+      // after a long period from looking like a slow drift forever.
+      const double rate = std::abs(temp - last_temp_) / dt;
+      slope_            = 0.5 * slope_ + 0.5 * rate;
+    }
+  }
+  primed_    = true;
+  last_temp_ = temp;
+  last_time_ = now;
+
+  const bool near = std::ranges::any_of(thresholds_, [&](int32_t t) {
+    return std::abs(temp - t) <= near_threshold;
+  });
+  if (slope_ >= fast_slope || near) period_ = min_period_;
+  else period_ = std::min(period_ * 2, max_period_);
+  return period_;
+}
+} // namespace clevo
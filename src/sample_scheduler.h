@@ -0,0 +1,59 @@
+//===- sample_scheduler.h - Adaptive sampling period ------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Chooses the worker's next sampling period from the temperature trend:
+/// sample at the minimum period while the temperature moves quickly or sits
+/// next to a curve threshold, and back off exponentially towards the maximum
+/// period while it is stable.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_SAMPLE_SCHEDULER_H
+#define CLEVO_SAMPLE_SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace clevo {
+class SampleScheduler {
+public:
+  using duration   = std::chrono::milliseconds;
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /// Slope (°C/s, smoothed) at or above which the minimum period is used.
+  static constexpr double fast_slope = 0.5;
+  /// Distance (°C) to a threshold at or below which the minimum period is
+  /// used.
+  static constexpr int32_t near_threshold = 1;
+
+  SampleScheduler(
+      duration                 min_period,
+      duration                 max_period,
+      std::span<const int32_t> thresholds
+  );
+
+  /// Feeds the controller input \p temp sampled at \p now and returns the
+  /// delay until the next sample.
+  duration next_period(int32_t temp, time_point now);
+
+  double slope() const { return slope_; }
+
+private:
+  duration             min_period_;
+  duration             max_period_;
+  duration             period_;
+  std::vector<int32_t> thresholds_;
+  bool                 primed_    = false;
+  int32_t              last_temp_ = 0;
+  time_point           last_time_;
+  double               slope_ = 0.0;
+};
+} // namespace clevo
+
+#endif // CLEVO_SAMPLE_SCHEDULER_H
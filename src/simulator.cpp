@@ -0,0 +1,261 @@
+//===- simulator.cpp - Offline fan curve replay -----------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the trace conversion and the two replay loops.
+///
+//===----------------------------------------------------------------------===//
+
+#include "simulator.h"
+
+#include "ec_snapshot.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+
+namespace clevo {
+namespace {
+uint8_t clamp_temp(int32_t temp) {
+  return static_cast<uint8_t>(std::clamp<int32_t>(temp, 0, 255));
+}
+
+/// The parts of a result that do not depend on the controller: plain
+/// integer reductions over the arrays, which the compiler vectorizes.
+SimResult measure_trace(const SimTrace& trace, size_t fan, int32_t threshold) {
+  const uint32_t* dt    = trace.dt_ms.data();
+  const uint8_t*  temp  = trace.temp[fan].data();
+  const size_t    n     = trace.size();
+  uint64_t        total = 0, above = 0;
+  uint8_t         peak  = 0;
+  for (size_t i = 0; i < n; ++i) {
+    total += dt[i];
+    above += int32_t(temp[i]) > threshold ? dt[i] : 0;
+    peak   = std::max(peak, temp[i]);
+  }
+
+  SimResult result;
+  result.samples    = n;
+  result.duration   = double(total) * 1e-3;
+  result.time_above = double(above) * 1e-3;
+  result.peak_temp  = peak;
+  return result;
+}
+
+/// Runs \p decide over fan \p fan. \p decide(temp, duty, last, dt) returns
+/// the duty to command or -1; \p restart() resets controller state. As in
+/// the worker, decisions go through \p ramp, if any, which writes its steps
+/// every RampParams::step, and every duty written is read back through the
+/// EC's raw 0-255 scale.
+template <typename Decide, typename Restart>
+SimResult replay(
+    const SimTrace&     trace,
+    size_t              fan,
+    int32_t             threshold,
+    const ThermalModel& thermal,
+    DutyRamp*           ramp,
+    Decide&&            decide,
+    Restart&&           restart
+) {
+  SimResult   result   = measure_trace(trace, fan, threshold);
+  const auto* dt       = trace.dt_ms.data();
+  const auto* temp     = trace.temp[fan].data();
+  const auto* recorded = trace.duty[fan].data();
+  const bool  feedback = thermal.gain > 0;
+  int32_t     duty     = 0;
+  int32_t     last     = -1;
+  uint64_t    on_ms    = 0;
+  uint64_t    duty_ms  = 0;
+  uint64_t    above_ms = 0;
+  int32_t     peak     = 0;
+  double      offset   = 0.0; ///< simulated minus recorded temperature
+  uint32_t    alpha_dt = 0;
+  double      alpha    = 0.0;
+  uint64_t    now_ms   = 0;
+  uint32_t    to_step  = 0; ///< ms until the next ramp write
+
+  const uint32_t step_ms =
+      ramp ? uint32_t(std::max<int64_t>(ramp->params().step.count(), 1)) : 0;
+  const auto at      = [](uint64_t ms) {
+    return DutyRamp::time_point(std::chrono::milliseconds(ms));
+  };
+  const auto run_for = [&](uint32_t ms) {
+    on_ms += duty > 0 ? ms : 0;
+    duty_ms += uint64_t(ms) * uint32_t(duty);
+    now_ms += ms;
+  };
+  const auto command = [&](int32_t next) {
+    duty = calculate_fan_duty(calculate_raw_fan_duty(next));
+  };
+
+  for (size_t i = 0; i < trace.size(); ++i) {
+    // The interval up to this sample ran at the duty decided before it, or
+    // at the steps of the ramp heading from it.
+    if (dt[i] == 0) {
+      duty   = recorded[i];
+      last   = -1;
+      offset = 0.0;
+      restart();
+      if (ramp) ramp->reset();
+    }
+    uint32_t left = dt[i];
+    for (; ramp && ramp->active() && left >= to_step; to_step = step_ms) {
+      run_for(to_step);
+      left -= to_step;
+      command(ramp->advance(at(now_ms)));
+    }
+    if (ramp && ramp->active()) to_step -= left;
+    run_for(left);
+
+    int32_t t = temp[i];
+    if (feedback) {
+      // Exact step of the first order lag; intervals rarely change, so
+      // exp() is only evaluated when they do.
+      if (dt[i] != alpha_dt)
+        alpha_dt = dt[i],
+        alpha    = 1.0 - std::exp(-double(dt[i]) * 1e-3 / thermal.tau);
+      offset += (thermal.gain * (recorded[i] - duty) - offset) * alpha;
+      t = std::clamp<int32_t>(
+          static_cast<int32_t>(std::lround(temp[i] + offset)), 0, 255
+      );
+      above_ms += t > threshold ? dt[i] : 0;
+      peak = std::max(peak, t);
+    }
+
+    // Decide from where the ramp is heading, not from an intermediate duty.
+    const int32_t current = ramp && ramp->active() ? ramp->target() : duty;
+    const int32_t next    = decide(t, current, last, dt[i]);
+    if (next < 0) continue;
+    last = next;
+    if (next != current) ++result.duty_changes;
+    if (!ramp) {
+      command(next);
+      continue;
+    }
+    ramp->set_target(duty, next, at(now_ms));
+    command(ramp->advance(at(now_ms)));
+    to_step = step_ms;
+  }
+  result.fan_on       = double(on_ms) * 1e-3;
+  result.duty_seconds = double(duty_ms) * 1e-3;
+  if (feedback) {
+    result.time_above = double(above_ms) * 1e-3;
+    result.peak_temp  = peak;
+  }
+  return result;
+}
+} // namespace
+
+void SimTrace::load(const TraceReader& trace, std::span<const EcFan> fans) {
+  fan_count = std::min(fans.size(), ec_max_fans);
+  const size_t n = trace.size();
+  dt_ms.resize(n);
+  for (size_t f = 0; f < fan_count; ++f) {
+    temp[f].resize(n);
+    duty[f].resize(n);
+  }
+
+  int64_t prev = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const TraceRecord& r   = trace[i];
+    const int64_t      gap = r.timestamp_ns - prev;
+    prev = r.timestamp_ns;
+    // Keep real intervals at 1 ms or more: 0 marks a restart.
+    dt_ms[i] = i == 0 || gap < 0 || gap > max_gap_ns
+                   ? 0
+                   : std::max<uint32_t>(uint32_t(gap / 1'000'000), 1);
+    for (size_t f = 0; f < fan_count; ++f) {
+      int32_t t = std::max(r.cpu_temp, r.gpu_temp);
+      if (fans[f].sensor == EcFanSensor::cpu) t = r.cpu_temp;
+      if (fans[f].sensor == EcFanSensor::gpu) t = r.gpu_temp;
+      temp[f][i] = clamp_temp(t);
+      duty[f][i] = static_cast<uint8_t>(std::clamp(r.duty[f], 0, 100));
+    }
+  }
+}
+
+std::errc parse_thermal_model(std::string_view spec, ThermalModel& model) {
+  ThermalModel parsed = model;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    double v;
+    auto   res = std::from_chars(value.begin(), value.end(), v);
+    if (res.ec != std::errc() || res.ptr != value.end())
+      return std::errc::invalid_argument;
+
+    if (key == "gain") parsed.gain = v;
+    else if (key == "tau") parsed.tau = v;
+    else return std::errc::invalid_argument;
+  }
+  if (parsed.gain < 0 || parsed.tau <= 0) return std::errc::invalid_argument;
+  model = parsed;
+  return std::errc();
+}
+
+void SimResult::merge(const SimResult& other) {
+  samples += other.samples;
+  duty_changes += other.duty_changes;
+  duration += other.duration;
+  time_above += other.time_above;
+  fan_on += other.fan_on;
+  duty_seconds += other.duty_seconds;
+  peak_temp = std::max(peak_temp, other.peak_temp);
+}
+
+SimResult simulate_curve(
+    const SimTrace&     trace,
+    size_t              fan,
+    const FanCurve&     curve,
+    int32_t             threshold,
+    const ThermalModel& thermal,
+    const RampParams&   ramp,
+    int32_t             min_duty
+) {
+  DutyRamp duty_ramp(ramp, min_duty);
+  return replay(
+      trace,
+      fan,
+      threshold,
+      thermal,
+      &duty_ramp,
+      [&](int32_t temp, int32_t duty, int32_t last, uint32_t) {
+        return decide_curve_step(curve, temp, duty, last).duty;
+      },
+      [] {}
+  );
+}
+
+SimResult simulate_pid(
+    const SimTrace&     trace,
+    size_t              fan,
+    const PidParams&    params,
+    int32_t             threshold,
+    const ThermalModel& thermal
+) {
+  PidController pid(params);
+  return replay(
+      trace,
+      fan,
+      threshold,
+      thermal,
+      nullptr,
+      [&](int32_t temp, int32_t, int32_t last, uint32_t dt) {
+        const int32_t next = pid.update(temp, double(dt) * 1e-3);
+        return next == last ? -1 : next;
+      },
+      [&] { pid.reset(); }
+  );
+}
+} // namespace clevo
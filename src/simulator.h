@@ -0,0 +1,106 @@
+//===- simulator.h - Offline fan curve replay -------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Replays a recorded trace through the decision logic of the -1 worker
+/// (decide_curve_step() or PidController) and measures how busy and how hot
+/// the result is. Like the worker, curve decisions are spread over time by
+/// a DutyRamp, and every duty is read back through the EC's raw 0-255 scale
+/// (17% reads back as 16%); otherwise the EC is ideal and always runs the
+/// commanded duty. Traces are loaded once into a structure of arrays so each
+/// replay streams over two small arrays per fan.
+///
+/// A first order thermal model lets the replayed duty feed back into the
+/// temperature: running below the recorded duty heats the sensor towards
+/// gain °C per % of difference with time constant tau, running above it
+/// cools. gain=0, the default, replays the recorded temperatures unchanged.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_SIMULATOR_H
+#define CLEVO_SIMULATOR_H
+
+#include "duty_ramp.h"
+#include "ec_backend.h"
+#include "fan_curve.h"
+#include "pid.h"
+#include "trace.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace clevo {
+/// A trace reduced to what the controllers read.
+struct SimTrace {
+  /// Gaps longer than this mean the worker was not running; the replay
+  /// starts over from the recorded duty.
+  static constexpr int64_t max_gap_ns = 60'000'000'000;
+
+  size_t                                        fan_count = 0;
+  std::vector<uint32_t>                         dt_ms; ///< 0 at a restart
+  std::array<std::vector<uint8_t>, ec_max_fans> temp;  ///< °C, per fan
+  std::array<std::vector<uint8_t>, ec_max_fans> duty;  ///< recorded, per fan
+
+  size_t size() const { return dt_ms.size(); }
+
+  /// Converts \p trace, feeding every fan of \p fans from its own sensor
+  /// as the worker does.
+  void load(const TraceReader& trace, std::span<const EcFan> fans);
+};
+
+struct ThermalModel {
+  double gain = 0.0;  ///< °C per % of duty, 0 keeps the recorded temperatures
+  double tau  = 60.0; ///< s
+};
+
+/// What --tune and --thermal start from: a duty below the recorded one heats.
+inline constexpr ThermalModel default_thermal_model{.gain = 0.25};
+
+/// Parses "key=value,..." with the keys gain and tau on top of the defaults
+/// in \p model.
+std::errc parse_thermal_model(std::string_view spec, ThermalModel& model);
+
+struct SimResult {
+  size_t  samples      = 0;
+  size_t  duty_changes = 0;
+  double  duration     = 0.0; ///< s
+  double  time_above   = 0.0; ///< s above the threshold
+  double  fan_on       = 0.0; ///< s with a duty above 0
+  double  duty_seconds = 0.0; ///< integral of the duty, %*s
+  int32_t peak_temp    = 0;
+
+  void merge(const SimResult& other);
+};
+
+/// Replays fan \p fan of \p trace through \p curve and a DutyRamp with
+/// \p ramp and \p min_duty, counting time above \p threshold °C.
+SimResult simulate_curve(
+    const SimTrace&     trace,
+    size_t              fan,
+    const FanCurve&     curve,
+    int32_t             threshold,
+    const ThermalModel& thermal  = {},
+    const RampParams&   ramp     = {},
+    int32_t             min_duty = 0
+);
+
+/// Replays fan \p fan of \p trace through a PidController.
+SimResult simulate_pid(
+    const SimTrace&     trace,
+    size_t              fan,
+    const PidParams&    params,
+    int32_t             threshold,
+    const ThermalModel& thermal = {}
+);
+} // namespace clevo
+
+#endif // CLEVO_SIMULATOR_H
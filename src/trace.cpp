@@ -0,0 +1,242 @@
+//===- trace.cpp - Memory mapped sample trace -------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the trace file writer, the reader and the text dumps.
+///
+//===----------------------------------------------------------------------===//
+
+#include "trace.h"
+
+#include <fmt/format.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+namespace clevo {
+namespace {
+size_t trace_size(uint32_t capacity) {
+  return sizeof(TraceHeader) + sizeof(TraceRecord) * capacity;
+}
+
+bool valid_header(const TraceHeader& header, size_t file_size) {
+  return header.magic == TraceHeader::magic_value &&
+         header.version == TraceHeader::version_value &&
+         header.record_size == sizeof(TraceRecord) && header.capacity > 0 &&
+         file_size >= trace_size(header.capacity);
+}
+
+/// Opens or creates \p file with the permissions of the real user. The
+/// binary runs setuid root, which must not let the caller create or
+/// overwrite files it could not write itself.
+int open_as_real_user(const char* file) {
+  const uid_t euid = geteuid();
+  const bool  drop = euid != getuid();
+  if (drop && seteuid(getuid()) < 0) return -1;
+  int       fd  = ::open(file, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+  const int err = errno;
+  if (drop && seteuid(euid) < 0) {
+    const int restore_err = errno;
+    if (fd >= 0) close(fd);
+    errno = restore_err;
+    return -1;
+  }
+  errno = err;
+  return fd;
+}
+
+void format_csv(fmt::memory_buffer& out, const TraceRecord& r) {
+  auto it = std::back_inserter(out);
+  it      = fmt::format_to(
+      it, "{},{},{},{}", r.timestamp_ns, r.cpu_temp, r.gpu_temp, r.manual
+  );
+  for (size_t i = 0; i < ec_max_fans; ++i)
+    it = fmt::format_to(
+        it, ",{},{},{}", r.duty[i], r.rpms[i], r.commanded_duty[i]
+    );
+  for (uint8_t reg : r.raw) it = fmt::format_to(it, ",{}", reg);
+  out.push_back('\n');
+}
+
+void format_jsonl(fmt::memory_buffer& out, const TraceRecord& r) {
+  auto it = std::back_inserter(out);
+  it      = fmt::format_to(
+      it,
+      "{{\"timestamp_ns\":{},\"cpu_temp\":{},\"gpu_temp\":{},"
+      "\"manual\":{},\"fans\":[",
+      r.timestamp_ns,
+      r.cpu_temp,
+      r.gpu_temp,
+      r.manual ? "true" : "false"
+  );
+  for (size_t i = 0; i < r.fan_count && i < ec_max_fans; ++i)
+    it = fmt::format_to(
+        it,
+        "{}{{\"duty\":{},\"rpms\":{},\"commanded_duty\":{}}}",
+        i ? "," : "",
+        r.duty[i],
+        r.rpms[i],
+        r.commanded_duty[i]
+    );
+  it = fmt::format_to(it, "],\"raw\":[");
+  for (size_t i = 0; i < r.raw.size(); ++i)
+    it = fmt::format_to(it, "{}{}", i ? "," : "", r.raw[i]);
+  it = fmt::format_to(it, "]}}\n");
+}
+} // namespace
+
+void store_trace_raw(
+    const EcSnapshot& snap, std::span<const EcFan> fans, TraceRecord& record
+) {
+  size_t n        = 0;
+  record.raw[n++] = snap.raw[k::ec_reg_cpu_temp];
+  record.raw[n++] = snap.raw[k::ec_reg_gpu_temp];
+  for (const EcFan& fan : fans.first(std::min(fans.size(), ec_max_fans))) {
+    record.raw[n++] = snap.raw[fan.duty_reg];
+    record.raw[n++] = snap.raw[fan.rpms_hi_reg];
+    record.raw[n++] = snap.raw[fan.rpms_lo_reg];
+  }
+}
+
+TraceWriter::~TraceWriter() {
+  if (!header_) return;
+  msync(header_, size_, MS_ASYNC);
+  munmap(header_, size_);
+}
+
+std::errc TraceWriter::open(
+    std::string_view path, std::string_view model, uint32_t capacity
+) {
+  if (capacity == 0) return std::errc::invalid_argument;
+  const std::string file(path);
+  int               fd = open_as_real_user(file.c_str());
+  if (fd < 0) return std::errc(errno);
+
+  auto fail = [&] {
+    int err = errno;
+    close(fd);
+    return std::errc(err);
+  };
+  struct stat st {};
+  size_ = trace_size(capacity);
+  if (fstat(fd, &st) < 0) return fail();
+  if (!S_ISREG(st.st_mode)) return errno = EINVAL, fail();
+  // Reserve the blocks up front so a full disk fails here, not as SIGBUS.
+  if (static_cast<size_t>(st.st_size) < size_ &&
+      (errno = posix_fallocate(fd, 0, static_cast<off_t>(size_))))
+    return fail();
+  void* mem = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) return fail();
+  close(fd);
+
+  header_  = static_cast<TraceHeader*>(mem);
+  records_ = reinterpret_cast<TraceRecord*>(header_ + 1);
+  if (!valid_header(*header_, size_) || header_->capacity != capacity) {
+    std::memset(static_cast<void*>(header_), 0, sizeof(TraceHeader));
+    header_->magic       = TraceHeader::magic_value;
+    header_->version     = TraceHeader::version_value;
+    header_->capacity    = capacity;
+    header_->record_size = sizeof(TraceRecord);
+    header_->head.store(0, std::memory_order_relaxed);
+  }
+  const size_t n = std::min(model.size(), sizeof(header_->model) - 1);
+  std::memset(header_->model, 0, sizeof(header_->model));
+  std::copy_n(model.begin(), n, header_->model);
+  return std::errc();
+}
+
+TraceReader::~TraceReader() {
+  if (header_) munmap(const_cast<TraceHeader*>(header_), mapped_);
+}
+
+std::errc TraceReader::open(std::string_view path) {
+  const std::string file(path);
+  int               fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return std::errc(errno);
+
+  struct stat st {};
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    return std::errc(err);
+  }
+  mapped_ = static_cast<size_t>(st.st_size);
+  if (mapped_ < sizeof(TraceHeader)) {
+    close(fd);
+    return std::errc::invalid_argument;
+  }
+  void* mem = mmap(nullptr, mapped_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return std::errc(errno);
+
+  header_  = static_cast<const TraceHeader*>(mem);
+  records_ = reinterpret_cast<const TraceRecord*>(header_ + 1);
+  if (!valid_header(*header_, mapped_)) return std::errc::invalid_argument;
+  // Sequential scans of weeks of records benefit from readahead.
+  madvise(const_cast<TraceHeader*>(header_), mapped_, MADV_SEQUENTIAL);
+
+  const uint64_t head = header_->head.load(std::memory_order_acquire);
+  size_               = static_cast<size_t>(
+      std::min<uint64_t>(head, header_->capacity)
+  );
+  first_ = head - size_;
+  return std::errc();
+}
+
+std::string_view TraceReader::model() const {
+  return std::string_view(
+      header_->model, strnlen(header_->model, sizeof(header_->model))
+  );
+}
+
+std::optional<TraceFormat> parse_trace_format(std::string_view name) {
+  if (name == "csv") return TraceFormat::csv;
+  if (name == "jsonl") return TraceFormat::jsonl;
+  return std::nullopt;
+}
+
+std::errc dump_trace(std::string_view path, TraceFormat format, FILE* out) {
+  TraceReader trace;
+  if (auto err = trace.open(path); int(err)) return err;
+
+  fmt::memory_buffer buf;
+  if (format == TraceFormat::csv) {
+    fmt::format_to(
+        std::back_inserter(buf), "timestamp_ns,cpu_temp,gpu_temp,manual"
+    );
+    for (size_t i = 0; i < ec_max_fans; ++i)
+      fmt::format_to(
+          std::back_inserter(buf),
+          ",duty{0},rpms{0},commanded_duty{0}",
+          i
+      );
+    for (size_t i = 0; i < trace_raw_regs; ++i)
+      fmt::format_to(std::back_inserter(buf), ",raw{}", i);
+    buf.push_back('\n');
+  }
+  // Flush in large chunks instead of one write per record.
+  for (size_t i = 0; i < trace.size(); ++i) {
+    if (format == TraceFormat::csv) format_csv(buf, trace[i]);
+    else format_jsonl(buf, trace[i]);
+    if (buf.size() >= 64 * 1024) {
+      if (std::fwrite(buf.data(), 1, buf.size(), out) != buf.size())
+        return std::errc::io_error;
+      buf.clear();
+    }
+  }
+  if (buf.size() && std::fwrite(buf.data(), 1, buf.size(), out) != buf.size())
+    return std::errc::io_error;
+  return std::errc();
+}
+} // namespace clevo
@@ -0,0 +1,147 @@
+//===- trace.h - Memory mapped sample trace ---------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Records one fixed-size record per worker sample into a preallocated,
+/// memory mapped file that wraps like a ring, so weeks of history cost a
+/// store per tick and no syscalls. --dump-trace converts a trace to CSV or
+/// JSON Lines; it is also the input of offline curve tuning.
+///
+/// Layout (native endian, all fields naturally aligned):
+///   TraceHeader                                 64 bytes
+///   TraceRecord[capacity]                       64 bytes each
+/// header.head counts appended records; record n lives in slot
+/// n % capacity. Reopening a trace of the same capacity keeps appending.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_TRACE_H
+#define CLEVO_TRACE_H
+
+#include "ec_snapshot.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+/// Registers of a trace record: both temperatures, then duty, RPM high and
+/// RPM low of every fan.
+constexpr size_t trace_raw_regs = 2 + 3 * ec_max_fans;
+
+struct TraceRecord {
+  int64_t                             timestamp_ns = 0; ///< monotonic
+  int32_t                             cpu_temp     = 0;
+  int32_t                             gpu_temp     = 0;
+  std::array<int32_t, ec_max_fans>    duty{};
+  std::array<int32_t, ec_max_fans>    rpms{};
+  std::array<int32_t, ec_max_fans>    commanded_duty{}; ///< -1: none written
+  std::array<uint8_t, trace_raw_regs> raw{};
+  uint8_t                             fan_count = 0;
+  uint8_t                             manual    = 0;
+  std::array<uint8_t, 14>             reserved{};
+};
+
+struct TraceHeader {
+  static constexpr uint32_t magic_value   = 0x63667431; // "cft1"
+  static constexpr uint32_t version_value = 1;
+
+  uint32_t              magic;
+  uint32_t              version;
+  uint32_t              capacity;
+  uint32_t              record_size;
+  std::atomic<uint64_t> head;
+  char                  model[24]; ///< profile name, zero padded
+  uint8_t               reserved[16];
+};
+
+static_assert(sizeof(TraceRecord) == 64);
+static_assert(sizeof(TraceHeader) == 64);
+
+/// Fills the raw registers of \p record from \p snap, in trace_raw_regs
+/// order.
+void store_trace_raw(
+    const EcSnapshot& snap, std::span<const EcFan> fans, TraceRecord& record
+);
+
+class TraceWriter {
+public:
+  /// 2^20 records: about 24 days of 2 s samples in 64 MiB.
+  static constexpr uint32_t default_capacity = 1u << 20;
+
+  TraceWriter() = default;
+  TraceWriter(const TraceWriter&)            = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  ~TraceWriter();
+
+  /// Opens or creates \p path with room for \p capacity records. An
+  /// existing trace of another capacity or format is started over. The file
+  /// is opened as the real user, never through a symlink, and must be a
+  /// regular file.
+  std::errc open(
+      std::string_view path,
+      std::string_view model,
+      uint32_t         capacity = default_capacity
+  );
+
+  bool is_open() const { return header_ != nullptr; }
+
+  void append(const TraceRecord& record) {
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    records_[head % header_->capacity] = record;
+    header_->head.store(head + 1, std::memory_order_release);
+  }
+
+private:
+  TraceHeader* header_  = nullptr;
+  TraceRecord* records_ = nullptr;
+  size_t       size_    = 0;
+};
+
+class TraceReader {
+public:
+  TraceReader() = default;
+  TraceReader(const TraceReader&)            = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+  ~TraceReader();
+
+  /// Maps \p path read-only; std::errc::invalid_argument if it is not a
+  /// trace.
+  std::errc open(std::string_view path);
+
+  std::string_view model() const;
+
+  /// Number of records still held, at most the capacity.
+  size_t size() const { return size_; }
+
+  /// Record \p i, oldest first.
+  const TraceRecord& operator[](size_t i) const {
+    return records_[(first_ + i) % header_->capacity];
+  }
+
+private:
+  const TraceHeader* header_  = nullptr;
+  const TraceRecord* records_ = nullptr;
+  size_t             mapped_  = 0;
+  uint64_t           first_   = 0;
+  size_t             size_    = 0;
+};
+
+enum class TraceFormat { csv, jsonl };
+
+std::optional<TraceFormat> parse_trace_format(std::string_view name);
+
+/// Writes every record of the trace at \p path to \p out.
+std::errc dump_trace(std::string_view path, TraceFormat format, FILE* out);
+} // namespace clevo
+
+#endif // CLEVO_TRACE_H
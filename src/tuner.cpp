@@ -0,0 +1,231 @@
+//===- tuner.cpp - Parallel fan curve search --------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the candidate generator, the cost and the thread pool.
+///
+//===----------------------------------------------------------------------===//
+
+#include "tuner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+
+namespace clevo {
+namespace {
+/// splitmix64: a tiny generator with the same sequence everywhere, unlike
+/// the std distributions.
+class Random {
+public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  /// Uniform in [lo, hi].
+  int32_t uniform(int32_t lo, int32_t hi) {
+    return lo + static_cast<int32_t>(next() % uint64_t(hi - lo + 1));
+  }
+
+  double uniform(double lo, double hi) {
+    return lo + (hi - lo) * double(next() >> 11) * 0x1.0p-53;
+  }
+
+private:
+  uint64_t state_;
+};
+
+/// \p count distinct values of [0, \p n), ascending.
+std::vector<size_t> pick_sorted(Random& rng, size_t n, size_t count) {
+  std::vector<size_t> picks(n);
+  for (size_t i = 0; i < n; ++i) picks[i] = i;
+  for (size_t i = 0; i < count; ++i)
+    std::swap(picks[i], picks[i + rng.next() % (n - i)]);
+  picks.resize(count);
+  std::ranges::sort(picks);
+  return picks;
+}
+
+/// Picks 2-6 points: ascending temperatures in 40-95°C, ascending duties
+/// among the non-zero \p allowed duties, 2-10°C of hysteresis.
+FanCurve random_curve(Random& rng, std::span<const int32_t> allowed) {
+  std::vector<int32_t> duties;
+  for (int32_t d : allowed)
+    if (d > 0) duties.push_back(d);
+  std::ranges::sort(duties);
+  if (duties.size() < 2) duties = {30, 65, 100};
+
+  const auto count = static_cast<size_t>(rng.uniform(
+      2, static_cast<int32_t>(std::min<size_t>(duties.size(), 6))
+  ));
+  const auto duty_picks = pick_sorted(rng, duties.size(), count);
+  const auto temp_picks = pick_sorted(rng, 56, count);
+
+  std::array<CurvePoint, FanCurve::max_points> points{};
+  for (size_t i = 0; i < count; ++i)
+    points[i] = {
+        40 + static_cast<int32_t>(temp_picks[i]),
+        duties[duty_picks[i]],
+        rng.uniform(2, 10),
+    };
+  return FanCurve(std::span(points.data(), count), allowed);
+}
+
+PidParams random_pid(Random& rng, const PidParams& base) {
+  PidParams p = base;
+  p.setpoint  = rng.uniform(50, 80);
+  p.off_below = p.setpoint - rng.uniform(5, 20);
+  p.kp        = rng.uniform(0.5, 10.0);
+  p.ki        = rng.uniform(0.0, 1.0);
+  p.kd        = rng.uniform(0.0, 5.0);
+  return p;
+}
+
+/// Runs \p body(i) for i in [0, n) on \p threads threads. Workers claim
+/// small chunks from a shared counter, so fast candidates do not leave a
+/// core idle behind slow ones.
+template <typename F>
+void parallel_for(size_t n, size_t threads, F&& body) {
+  constexpr size_t    chunk = 4;
+  std::atomic<size_t> next{0};
+  auto                work = [&] {
+    for (size_t first; (first = next.fetch_add(chunk)) < n;)
+      for (size_t i = first; i < std::min(first + chunk, n); ++i) body(i);
+  };
+  std::vector<std::jthread> pool;
+  for (size_t t = 1; t < threads; ++t) pool.emplace_back(work);
+  work();
+}
+
+/// Parses all of \p value as a \p T, so "2.7" is no size_t and "1e30" no
+/// int32_t.
+template <typename T> bool parse_value(std::string_view value, T& out) {
+  auto res = std::from_chars(value.begin(), value.end(), out);
+  return res.ec == std::errc() && res.ptr == value.end();
+}
+} // namespace
+
+std::errc parse_tune_params(std::string_view spec, TuneParams& params) {
+  TuneParams parsed = params;
+  while (!spec.empty()) {
+    const size_t     comma = spec.find(',');
+    std::string_view item  = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view()
+                                           : spec.substr(comma + 1);
+
+    const size_t eq = item.find('=');
+    if (eq == std::string_view::npos) return std::errc::invalid_argument;
+    std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+
+    if (key == "mode") {
+      if (value == "curve") parsed.mode = TuneMode::curve;
+      else if (value == "pid") parsed.mode = TuneMode::pid;
+      else return std::errc::invalid_argument;
+      continue;
+    }
+    bool ok;
+    if (key == "candidates") ok = parse_value(value, parsed.candidates);
+    else if (key == "seed") ok = parse_value(value, parsed.seed);
+    else if (key == "threads") ok = parse_value(value, parsed.threads);
+    else if (key == "top") ok = parse_value(value, parsed.top);
+    else if (key == "limit") ok = parse_value(value, parsed.limit);
+    else if (key == "duty") ok = parse_value(value, parsed.duty);
+    else if (key == "changes") ok = parse_value(value, parsed.changes);
+    else if (key == "peak") ok = parse_value(value, parsed.peak);
+    else if (key == "hot") ok = parse_value(value, parsed.hot);
+    else return std::errc::invalid_argument;
+    if (!ok) return std::errc::invalid_argument;
+  }
+  if (parsed.candidates == 0 || parsed.top == 0 || parsed.limit < 0)
+    return std::errc::invalid_argument;
+  for (double weight : {parsed.duty, parsed.changes, parsed.peak, parsed.hot})
+    if (!std::isfinite(weight) || weight < 0)
+      return std::errc::invalid_argument;
+  params = parsed;
+  return std::errc();
+}
+
+double tune_cost(const SimResult& r, const TuneParams& params) {
+  const double duration = std::max(r.duration, 1e-9);
+  const double hours    = duration / 3600.0;
+  return params.duty * r.duty_seconds / duration +
+         params.changes * double(r.duty_changes) / std::max(hours, 1e-9) +
+         params.peak * std::max(0, r.peak_temp - params.limit) +
+         params.hot * 100.0 * r.time_above / duration;
+}
+
+TuneResult tune(
+    std::span<const SimTrace> traces,
+    const TuneParams&         params,
+    const FanCurve&           baseline_curve,
+    const PidParams&          baseline_pid,
+    std::span<const int32_t>  allowed_duties
+) {
+  // Candidate i is rebuilt from the seed and i, so only scores are kept
+  // while searching.
+  auto make = [&](size_t i) {
+    TuneCandidate c;
+    Random        rng(params.seed * 0x100000001b3 + i);
+    c.curve = i ? random_curve(rng, allowed_duties) : baseline_curve;
+    c.pid   = i ? random_pid(rng, baseline_pid) : baseline_pid;
+    return c;
+  };
+  struct Score {
+    double    cost  = 0.0;
+    size_t    index = 0;
+    SimResult result;
+  };
+  std::vector<Score> scores(params.candidates);
+  const int32_t      min_duty = lowest_spinning_duty(allowed_duties);
+  const size_t       threads  =
+      params.threads ? params.threads
+                     : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  parallel_for(scores.size(), threads, [&](size_t i) {
+    const TuneCandidate c = make(i);
+    Score&              s = scores[i];
+    s.index               = i;
+    const int32_t       limit   = params.limit;
+    const ThermalModel& thermal = params.thermal;
+    for (const SimTrace& trace : traces)
+      for (size_t f = 0; f < trace.fan_count; ++f)
+        s.result.merge(
+            params.mode == TuneMode::pid
+                ? simulate_pid(trace, f, c.pid, limit, thermal)
+                : simulate_curve(
+                      trace, f, c.curve, limit, thermal, params.ramp, min_duty
+                  )
+        );
+    s.cost = tune_cost(s.result, params);
+  });
+
+  auto finish = [&](const Score& s) {
+    TuneCandidate c = make(s.index);
+    c.cost          = s.cost;
+    c.result        = s.result;
+    return c;
+  };
+  TuneResult out;
+  out.baseline     = finish(scores[0]);
+  const size_t top = std::min(params.top, scores.size());
+  std::partial_sort(
+      scores.begin(),
+      scores.begin() + ptrdiff_t(top),
+      scores.end(),
+      [](const Score& a, const Score& b) { return a.cost < b.cost; }
+  );
+  for (size_t i = 0; i < top; ++i) out.best.push_back(finish(scores[i]));
+  return out;
+}
+} // namespace clevo
@@ -0,0 +1,83 @@
+//===- tuner.h - Parallel fan curve search ----------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Searches curve points (temperatures, duty steps, hysteresis) or PID
+/// gains by replaying recorded traces through the simulator and scoring
+/// each candidate with a cost that weighs fan noise against heat. The
+/// candidates are spread over every core; candidate i is derived from the
+/// seed and i alone, so a search is reproducible on any thread count.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_TUNER_H
+#define CLEVO_TUNER_H
+
+#include "fan_curve.h"
+#include "pid.h"
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace clevo {
+enum class TuneMode { curve, pid };
+
+/// The cost of a candidate is
+///   duty * mean duty (%) + changes * duty changes per hour
+///   + peak * °C of peak above limit + hot * % of time above limit
+/// summed over every fan of every trace.
+struct TuneParams {
+  TuneMode     mode       = TuneMode::curve;
+  size_t       candidates = 2000;
+  uint64_t     seed       = 1;
+  size_t       threads    = 0; ///< 0: one per core
+  size_t       top        = 5;
+  int32_t      limit      = 85; ///< °C
+  double       duty       = 1.0;
+  double       changes    = 0.5;
+  double       peak       = 10.0;
+  double       hot        = 5.0;
+  ThermalModel thermal = default_thermal_model; ///< or --thermal
+  RampParams   ramp;                            ///< set by --ramp
+};
+
+/// Parses "key=value,..." with the keys mode (curve|pid), candidates, seed,
+/// threads, top, limit, duty, changes, peak and hot on top of the defaults
+/// in \p params.
+std::errc parse_tune_params(std::string_view spec, TuneParams& params);
+
+struct TuneCandidate {
+  double    cost = 0.0;
+  SimResult result;
+  FanCurve  curve;
+  PidParams pid;
+};
+
+struct TuneResult {
+  TuneCandidate              baseline;
+  std::vector<TuneCandidate> best; ///< cheapest first
+};
+
+double tune_cost(const SimResult& result, const TuneParams& params);
+
+/// Scores params.candidates candidates against every fan of \p traces and
+/// keeps the params.top cheapest. Candidate 0 is the baseline curve or PID;
+/// curve duties are drawn from \p allowed_duties.
+TuneResult tune(
+    std::span<const SimTrace> traces,
+    const TuneParams&         params,
+    const FanCurve&           baseline_curve,
+    const PidParams&          baseline_pid,
+    std::span<const int32_t>  allowed_duties
+);
+} // namespace clevo
+
+#endif // CLEVO_TUNER_H
@@ -0,0 +1,182 @@
+//===- watch.cpp - Continuous snapshot stream -------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the sample encoder and the watch loop.
+///
+//===----------------------------------------------------------------------===//
+
+#include "watch.h"
+
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <iterator>
+
+namespace clevo {
+namespace {
+/// Writes all of \p data; a pipe takes it in one call, the loop only
+/// matters for short writes to a slow file.
+std::errc write_all(int fd, std::span<const char> data) {
+  while (!data.empty()) {
+    const ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0) return std::errc(errno);
+    data = data.subspan(size_t(n));
+  }
+  return std::errc();
+}
+} // namespace
+
+std::optional<WatchFormat> parse_watch_format(std::string_view name) {
+  if (name == "json") return WatchFormat::json;
+  if (name == "ndjson" || name == "jsonl") return WatchFormat::ndjson;
+  if (name == "csv") return WatchFormat::csv;
+  if (name == "binary") return WatchFormat::binary;
+  return std::nullopt;
+}
+
+SampleEncoder::SampleEncoder(
+    WatchFormat format, bool delta, std::span<const EcFan> fans
+)
+    : format_(format), delta_(delta) {
+  fans            = fans.first(std::min(fans.size(), ec_max_fans));
+  names_[0]       = "cpu_temp_cels";
+  names_[1]       = "gpu_temp_cels";
+  field_count_    = 2;
+  const bool many = fans.size() > 1;
+  for (const EcFan& fan : fans) {
+    const std::string prefix = many ? fmt::format("{}_", fan.name) : "";
+    names_[field_count_++]   = prefix + "duty";
+    names_[field_count_++]   = prefix + "rpms";
+  }
+}
+
+std::span<const char>
+SampleEncoder::encode(const EcSnapshot& snap, int64_t timestamp_ns) {
+  values_[0] = snap.cpu_temp;
+  values_[1] = snap.gpu_temp;
+  for (size_t i = 0, f = 2; f < field_count_; ++i) {
+    values_[f++] = snap.fans[i].duty;
+    values_[f++] = snap.fans[i].rpms;
+  }
+
+  uint32_t mask = 0;
+  for (size_t f = 0; f < field_count_; ++f)
+    if (!delta_ || first_ || values_[f] != last_[f]) mask |= 1u << f;
+  last_ = values_;
+
+  buf_.clear();
+  if (mask != 0) {
+    if (format_ == WatchFormat::binary) format_binary(timestamp_ns, mask);
+    else format_text(timestamp_ns, mask);
+  }
+  first_ = false;
+  return std::span(buf_.data(), buf_.size());
+}
+
+void SampleEncoder::format_text(int64_t timestamp_ns, uint32_t mask) {
+  auto it = std::back_inserter(buf_);
+  if (format_ == WatchFormat::csv) {
+    if (first_) {
+      it = fmt::format_to(it, "timestamp_ns");
+      for (size_t f = 0; f < field_count_; ++f)
+        it = fmt::format_to(it, ",{}", names_[f]);
+      buf_.push_back('\n');
+    }
+    // Unchanged fields are left empty.
+    it = fmt::format_to(it, "{}", timestamp_ns);
+    for (size_t f = 0; f < field_count_; ++f) {
+      buf_.push_back(',');
+      if (mask & (1u << f)) it = fmt::format_to(it, "{}", values_[f]);
+    }
+    buf_.push_back('\n');
+    return;
+  }
+
+  // json pretty prints each sample, ndjson keeps it on one line.
+  if (format_ == WatchFormat::json) {
+    it = fmt::format_to(it, "{{\n  \"timestamp_ns\": {}", timestamp_ns);
+    for (size_t f = 0; f < field_count_; ++f)
+      if (mask & (1u << f))
+        it = fmt::format_to(it, ",\n  \"{}\": {}", names_[f], values_[f]);
+    it = fmt::format_to(it, "\n}}\n");
+    return;
+  }
+  it = fmt::format_to(it, "{{\"timestamp_ns\":{}", timestamp_ns);
+  for (size_t f = 0; f < field_count_; ++f)
+    if (mask & (1u << f))
+      it = fmt::format_to(it, ",\"{}\":{}", names_[f], values_[f]);
+  it = fmt::format_to(it, "}}\n");
+}
+
+void SampleEncoder::format_binary(int64_t timestamp_ns, uint32_t mask) {
+  const WatchRecordHeader header{.timestamp_ns = timestamp_ns, .mask = mask};
+  const char*             bytes = reinterpret_cast<const char*>(&header);
+  buf_.append(bytes, bytes + sizeof(header));
+  for (size_t f = 0; f < field_count_; ++f) {
+    if (!(mask & (1u << f))) continue;
+    bytes = reinterpret_cast<const char*>(&values_[f]);
+    buf_.append(bytes, bytes + sizeof(int32_t));
+  }
+}
+
+std::errc watch_snapshots(
+    EcBackend&              backend,
+    const EcSnapshotLayout& layout,
+    const WatchParams&      params,
+    int                     fd
+) {
+  EventLoop loop;
+  Timer     tick;
+  SignalFd  signals;
+  if (auto err = loop.open(); int(err)) return err;
+  if (auto err = tick.open(); int(err)) return err;
+  // SIGPIPE is blocked, so a closed reader shows up as EPIPE.
+  if (auto err = signals.open({SIGHUP, SIGINT, SIGPIPE, SIGTERM}); int(err))
+    return err;
+
+  SampleEncoder encoder(params.format, params.delta, layout.fans());
+  EcSnapshot    snap;
+  bool          running = true;
+  std::errc     result  = std::errc();
+  loop.add(signals.fd(), EPOLLIN, [&](uint32_t) {
+    if (signals.read()) running = false;
+  });
+
+  auto deadline = std::chrono::steady_clock::now();
+  loop.add(tick.fd(), EPOLLIN, [&](uint32_t) {
+    tick.drain();
+    if (auto err = ec_read_snapshot(backend, layout, snap); int(err)) {
+      fmt::print(stderr, "unable to read EC from {}\n", backend.name());
+      result  = err;
+      running = false;
+      return;
+    }
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    const auto out = encoder.encode(
+        snap, std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()
+    );
+    if (auto err = write_all(fd, out); int(err)) {
+      if (err != std::errc::broken_pipe) result = err;
+      running = false;
+      return;
+    }
+    const auto mono = std::chrono::steady_clock::now();
+    do deadline += params.interval;
+    while (deadline <= mono);
+    tick.arm_at(deadline);
+  });
+  tick.arm_at(deadline);
+
+  while (running)
+    if (auto err = loop.run_once(); int(err)) return err;
+  return result;
+}
+} // namespace clevo
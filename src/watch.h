@@ -0,0 +1,97 @@
+//===- watch.h - Continuous snapshot stream ---------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Streams a snapshot every interval to a file descriptor. Each sample is
+/// formatted into a buffer reused across samples and leaves with a single
+/// write, so readers of a pipe never see half a sample.
+///
+/// A sample is a timestamp followed by the fields cpu_temp_cels,
+/// gpu_temp_cels, then duty and rpms of every fan; with several fans those
+/// are prefixed by the fan name ("cpu_duty", ...). In delta mode the first
+/// sample carries every field, later ones only the fields that changed, and
+/// samples without changes are not written at all.
+///
+/// binary is native endian: a WatchRecordHeader, then one int32_t per bit
+/// set in mask, in field order.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_WATCH_H
+#define CLEVO_WATCH_H
+
+#include "ec_backend.h"
+#include "ec_snapshot.h"
+
+#include <fmt/format.h>
+
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+enum class WatchFormat { json, ndjson, csv, binary };
+
+/// Also accepts jsonl for ndjson, as --dump-trace names it.
+std::optional<WatchFormat> parse_watch_format(std::string_view name);
+
+struct WatchParams {
+  WatchFormat               format = WatchFormat::ndjson;
+  bool                      delta  = false;
+  std::chrono::milliseconds interval{1000};
+};
+
+struct WatchRecordHeader {
+  int64_t  timestamp_ns = 0; ///< realtime
+  uint32_t mask         = 0; ///< bit i: field i follows
+  uint32_t reserved     = 0;
+};
+
+static_assert(sizeof(WatchRecordHeader) == 16);
+
+class SampleEncoder {
+public:
+  static constexpr size_t max_fields = 2 + 2 * ec_max_fans;
+
+  SampleEncoder(WatchFormat format, bool delta, std::span<const EcFan> fans);
+
+  /// Formats \p snap; the result stays valid until the next call. Empty
+  /// when delta encoding found nothing to send.
+  std::span<const char> encode(const EcSnapshot& snap, int64_t timestamp_ns);
+
+private:
+  void format_text(int64_t timestamp_ns, uint32_t mask);
+  void format_binary(int64_t timestamp_ns, uint32_t mask);
+
+  WatchFormat                         format_;
+  bool                                delta_;
+  bool                                first_       = true;
+  size_t                              field_count_ = 0;
+  std::array<std::string, max_fields> names_;
+  std::array<int32_t, max_fields>     values_{};
+  std::array<int32_t, max_fields>     last_{};
+  fmt::memory_buffer                  buf_;
+};
+
+/// Writes a sample of \p layout to \p fd every params.interval until
+/// SIGINT/SIGTERM or until the reader goes away.
+std::errc watch_snapshots(
+    EcBackend&              backend,
+    const EcSnapshotLayout& layout,
+    const WatchParams&      params,
+    int                     fd = STDOUT_FILENO
+);
+} // namespace clevo
+
+#endif // CLEVO_WATCH_H
@@ -0,0 +1,487 @@
+//===- worker.h - State of the -1 worker ------------------------*- C++ -*-===//
+//
+// TODO: License
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// The per-fan control state of the -1 worker and the decisions it takes on
+/// every sample. ec_worker in clevo_fan_control.cpp drives it from its event
+/// loop; the stress test drives it against the simulated EC.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLEVO_WORKER_H
+#define CLEVO_WORKER_H
+
+#include "config_file.h"
+#include "control_socket.h"
+#include "duty_ramp.h"
+#include "ec_backend.h"
+#include "ec_io.h"
+#include "ec_snapshot.h"
+#include "fan_curve.h"
+#include "fan_monitor.h"
+#include "feed_forward.h"
+#include "hwmon.h"
+#include "logger.h"
+#include "metrics.h"
+#include "model_profile.h"
+#include "pid.h"
+#include "sample_ring.h"
+#include "trace.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <system_error>
+
+namespace clevo {
+/// Writes \p duty_percentage to \p fan, rejecting values outside 0-100.
+inline std::errc ec_write_fan_duty(
+    EcBackend& backend, const EcFan& fan, int32_t duty_percentage
+) {
+  if (duty_percentage < 0 || duty_percentage > 100) {
+    fmt::print("Wrong fan duty to write: {}\n", duty_percentage);
+    return std::errc::invalid_argument;
+  }
+  return backend.write_fan_duty(fan, calculate_raw_fan_duty(duty_percentage));
+}
+
+/// Counts of duty writes the worker issued, skipped because the EC already
+/// reported the duty, and re-issued because the EC changed it behind us.
+struct DutyWriteStats {
+  uint64_t issued    = 0;
+  uint64_t skipped   = 0;
+  uint64_t overrides = 0;
+};
+
+/// Duty the worker leaves the fans at when it quits or the system sleeps.
+inline constexpr int32_t ec_handoff_duty = 40;
+
+/// Control state of one fan of the worker.
+struct FanChannel {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  const EcFan*                 fan = nullptr;
+  DutyRamp                     ramp;
+  FanMonitor                   monitor;
+  std::optional<PidController> pid;
+  std::optional<time_point>    last_pid_update;
+  double                       temp           = 0.0; ///< controller input
+  int32_t                      fan_duty       = 0;
+  int32_t                      auto_duty_val  = -1;
+  int32_t                      commanded_duty = -1;
+  uint8_t                      observed_raw   = 0;
+  bool                         reassert       = false;
+};
+
+/// State of the -1 worker, shared with control socket clients. Every fan of
+/// \p Profile is controlled from its own sensor.
+template <const ModelProfile& Profile>
+class WorkerState final : public ControlHandler {
+public:
+  static constexpr const EcSnapshotLayout& layout = Profile.layout;
+  static constexpr int32_t min_duty =
+      lowest_spinning_duty(Profile.allowed_duties);
+
+  WorkerState(EcBackend& ec, const FanCurve& fan_curve)
+      : backend(ec), curve(fan_curve) {
+    for (size_t i = 0; i < channels.size(); ++i) {
+      channels[i].fan = &layout.fans()[i];
+      channels[i].ramp.set_min_duty(min_duty);
+    }
+  }
+
+  const EcSnapshot& snapshot() const override { return snap; }
+  bool              manual() const override { return manual_duty >= 0; }
+  bool              sleeping() const override { return bool(sleeping_since); }
+
+  std::errc set_duty(int32_t duty) override {
+    if (duty < 0) {
+      manual_duty = -1;
+      for (FanChannel& ch : channels) {
+        ch.auto_duty_val = -1;
+        if (ch.pid) ch.pid->reset(), ch.last_pid_update.reset();
+        ch.ramp.reset();
+      }
+      logger().log(LogLevel::notice, "control socket: auto fan duty");
+      return std::errc();
+    }
+    logger().log(LogLevel::notice, "control socket: fan duty to {}%", duty);
+    for (FanChannel& ch : channels) {
+      ch.ramp.reset();
+      if (auto err = command_duty(ch, duty); int(err)) return err;
+    }
+    manual_duty = duty;
+    return std::errc();
+  }
+
+  /// Wake requests that never come, e.g. after a failed suspend, do not keep
+  /// the fans at the handoff duty for longer than this.
+  static constexpr std::chrono::seconds max_sleep{60};
+
+  std::errc suspend() override {
+    logger().log(
+        LogLevel::notice, "suspending, fan duty to {}%", ec_handoff_duty
+    );
+    for (FanChannel& ch : channels) {
+      ch.ramp.reset();
+      ch.commanded_duty = -1;
+      ch.reassert       = false;
+      if (auto err = ec_write_fan_duty(backend, *ch.fan, ec_handoff_duty);
+          int(err))
+        return err;
+    }
+    sleeping_since = std::chrono::steady_clock::now();
+    return std::errc();
+  }
+
+  /// Takes the fans back after a suspend. The ramp and PID history are
+  /// stale and the EC may have reset the duty, so the next sample decides
+  /// afresh and re-asserts the commanded duty.
+  void resume() override {
+    sleeping_since.reset();
+    for (FanChannel& ch : channels) {
+      ch.ramp.reset();
+      if (ch.pid) ch.pid->reset(), ch.last_pid_update.reset();
+      ch.auto_duty_val = -1;
+      if (manual()) ch.commanded_duty = manual_duty;
+      ch.reassert = ch.commanded_duty >= 0;
+    }
+  }
+
+  /// Writes \p duty to the fan of \p ch unless the last snapshot already
+  /// reports it.
+  std::errc command_duty(FanChannel& ch, int32_t duty) {
+    if (duty < 0 || duty > 100)
+      return ec_write_fan_duty(backend, *ch.fan, duty);
+    ch.commanded_duty = duty;
+    ch.reassert       = false;
+    if (same_fan_duty(ch.observed_raw, calculate_raw_fan_duty(duty))) {
+      ++writes.skipped;
+      return std::errc();
+    }
+    ++writes.issued;
+    ch.observed_raw = calculate_raw_fan_duty(duty);
+    return ec_write_fan_duty(backend, *ch.fan, duty);
+  }
+
+  /// Records the duty the EC reports for \p ch and flags an override when it
+  /// no longer matches the last commanded duty.
+  void observe_duty(FanChannel& ch, uint8_t raw) {
+    if (ch.commanded_duty >= 0 &&
+        same_fan_duty(
+            ch.observed_raw, calculate_raw_fan_duty(ch.commanded_duty)
+        ) &&
+        !same_fan_duty(raw, ch.observed_raw)) {
+      ++writes.overrides;
+      ch.reassert = true;
+    }
+    ch.observed_raw = raw;
+  }
+
+  double sensor_temp(const EcFan& fan) const {
+    switch (fan.sensor) {
+    case EcFanSensor::cpu: return cpu_input;
+    case EcFanSensor::gpu: return gpu_input;
+    case EcFanSensor::hottest: break;
+    }
+    return std::max(cpu_input, gpu_input);
+  }
+
+  /// Fuses the EC temperatures with the hwmon sensors, if enabled.
+  void update_inputs() {
+    cpu_input = cpu_temp;
+    gpu_input = gpu_temp;
+    if (!hwmon) return;
+    hwmon->read();
+    cpu_input = fuse_temperature(cpu_temp, hwmon->cpu(), fusion);
+    gpu_input = fuse_temperature(gpu_temp, hwmon->gpu(), fusion);
+  }
+
+  /// Reads the EC and applies the automatic curve unless a manual duty is
+  /// commanded.
+  std::errc sample() {
+    if (feed_forward) update_feed_forward();
+    if (auto err = ec_read_snapshot(backend, layout, snap);
+        err == std::errc::message_size) {
+      logger().log(LogLevel::error, "wrong EC size from {}", backend.name());
+    } else if (int(err)) {
+      logger().log(
+          LogLevel::error, "unable to read EC from {}", backend.name()
+      );
+      return err;
+    } else {
+      cpu_temp = snap.cpu_temp;
+      gpu_temp = snap.gpu_temp;
+      update_inputs();
+      for (size_t i = 0; i < channels.size(); ++i) {
+        FanChannel& ch = channels[i];
+        ch.temp        = sensor_temp(*ch.fan);
+        ch.fan_duty    = snap.fans[i].duty;
+        observe_duty(ch, snap.raw[ch.fan->duty_reg]);
+        ch.monitor.update(ch.fan_duty, snap.fans[i].rpms);
+      }
+    }
+
+    if (sleeping_since) {
+      if (std::chrono::steady_clock::now() - *sleeping_since < max_sleep)
+        return std::errc();
+      logger().log(
+          LogLevel::warning,
+          "no wake request within {} s, taking the fans back",
+          max_sleep.count()
+      );
+      resume();
+    }
+
+    for (FanChannel& ch : channels) {
+      if (stall_guard && ch.monitor.stalled()) {
+        if (auto err = guard_stall(ch); int(err)) return err;
+        continue;
+      }
+      if (stall_guard && ch.monitor.stall_ended()) release_stall(ch);
+      if (!manual()) {
+        if (auto err = ch.pid ? run_pid(ch) : run_curve(ch); int(err))
+          return err;
+      }
+      // A new decision above already rewrote the duty; otherwise put back
+      // the one the EC replaced.
+      if (ch.reassert)
+        if (auto err = command_duty(ch, ch.commanded_duty); int(err))
+          return err;
+    }
+    return std::errc();
+  }
+
+  /// Switches to \p next between two samples. PID and ramp state carry over
+  /// when only their parameters change, so the duty does not jump.
+  void apply_settings(const ControlSettings& next) {
+    curve = next.curve;
+    for (FanChannel& ch : channels) {
+      ch.ramp.set_params(next.ramp);
+      if (next.pid.has_value() != ch.pid.has_value()) ch.auto_duty_val = -1;
+      if (!next.pid) ch.pid.reset(), ch.last_pid_update.reset();
+      else if (ch.pid) ch.pid->set_params(*next.pid);
+      else ch.pid.emplace(*next.pid);
+    }
+  }
+
+  /// Holds the stall duty on \p ch while its fan reads 0 RPM. The curve and
+  /// PID state are dropped, so control starts over once it spins again.
+  std::errc guard_stall(FanChannel& ch) {
+    const int32_t duty = ch.monitor.params().duty;
+    if (ch.monitor.stall_began()) {
+      const std::array<LogField, 2> fields{{
+          {"FAN_DUTY", ch.fan_duty},
+          {"FAN_STALLS", int64_t(ch.monitor.stalls())},
+      }};
+      logger().log(
+          LogLevel::warning,
+          fields,
+          "{}{}fan stalled at {}%, forcing {}%",
+          channels.size() > 1 ? ch.fan->name : "",
+          channels.size() > 1 ? " " : "",
+          ch.fan_duty,
+          duty
+      );
+      ch.auto_duty_val = -1;
+      ch.ramp.reset();
+      if (ch.pid) ch.pid->reset(), ch.last_pid_update.reset();
+    }
+    return command_duty(ch, duty);
+  }
+
+  void release_stall(FanChannel& ch) {
+    logger().log(
+        LogLevel::notice,
+        "{}{}fan spinning again at {} RPM",
+        channels.size() > 1 ? ch.fan->name : "",
+        channels.size() > 1 ? " " : "",
+        ch.monitor.filtered()
+    );
+    if (manual()) ch.commanded_duty = manual_duty, ch.reassert = true;
+  }
+
+  /// Reads the load sensor and updates the feed-forward duty floor. A failed
+  /// read keeps the previous floor.
+  void update_feed_forward() {
+    const auto now  = std::chrono::steady_clock::now();
+    double     load = 0.0;
+    if (auto err = load_sensor.read(now, load); int(err)) {
+      logger().log(
+          LogLevel::warning, "unable to read load from {}", load_sensor.path()
+      );
+      return;
+    }
+    duty_floor = feed_forward->update(load, now);
+    if (feed_forward->jumped())
+      logger().log(
+          LogLevel::info,
+          "load jumped to {:.0f}%, raising duty to {}%",
+          load * 100.0,
+          duty_floor
+      );
+  }
+
+  /// Runs one step of the fan curve for \p ch on the last snapshot.
+  std::errc run_curve(FanChannel& ch) {
+    // Decide from where the ramp is heading, not from an intermediate duty.
+    const int32_t current = ch.ramp.active() ? ch.ramp.target() : ch.fan_duty;
+    const auto    step    = decide_curve_step(
+        curve,
+        static_cast<int32_t>(std::lround(ch.temp)),
+        current,
+        ch.auto_duty_val,
+        duty_floor
+    );
+    if (const int32_t next_duty = step.duty; next_duty != -1) {
+      log_duty(ch, step.floored ? "feed-forward" : "auto", next_duty);
+      ch.auto_duty_val = next_duty;
+      const auto now   = DutyRamp::clock::now();
+      ch.ramp.set_target(ch.fan_duty, next_duty, now);
+      return command_duty(ch, ch.ramp.advance(now));
+    }
+    return std::errc();
+  }
+
+  bool ramping() const {
+    return std::ranges::any_of(channels, [](const FanChannel& ch) {
+      return ch.ramp.active();
+    });
+  }
+
+  /// Writes the next intermediate duty of every ramp in progress.
+  std::errc step_ramps() {
+    if (manual()) return std::errc();
+    const auto now = DutyRamp::clock::now();
+    for (FanChannel& ch : channels)
+      if (ch.ramp.active())
+        if (auto err = command_duty(ch, ch.ramp.advance(now)); int(err))
+          return err;
+    return std::errc();
+  }
+
+  /// Runs one step of the PID controller of \p ch.
+  std::errc run_pid(FanChannel& ch) {
+    const auto now = std::chrono::steady_clock::now();
+    double     dt  = 0.0;
+    if (ch.last_pid_update)
+      dt = std::chrono::duration<double>(now - *ch.last_pid_update).count();
+    ch.last_pid_update = now;
+
+    const int32_t next_duty =
+        std::max(ch.pid->update(ch.temp, dt), duty_floor);
+    if (next_duty == ch.auto_duty_val) return std::errc();
+    log_duty(ch, "pid", next_duty);
+    ch.auto_duty_val = next_duty;
+    return command_duty(ch, next_duty);
+  }
+
+  void log_duty(const FanChannel& ch, std::string_view mode, int32_t duty)
+      const {
+    const std::array<LogField, 3> fields{{
+        {"CPU_TEMP", cpu_temp},
+        {"GPU_TEMP", gpu_temp},
+        {"FAN_DUTY", duty},
+    }};
+    logger().log(
+        LogLevel::info,
+        fields,
+        "CPU={}°C, GPU={}°C, {}{}{} fan duty to {}%",
+        cpu_temp,
+        gpu_temp,
+        mode,
+        channels.size() > 1 ? " " : "",
+        channels.size() > 1 ? ch.fan->name : "",
+        duty
+    );
+  }
+
+  Sample to_sample() const {
+    static_assert(ec_max_fans <= Sample::max_fans);
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    Sample     sample;
+    sample.timestamp_ns = std::chrono::nanoseconds(now).count();
+    sample.cpu_temp     = cpu_temp;
+    sample.gpu_temp     = gpu_temp;
+    sample.fan_count    = static_cast<int32_t>(channels.size());
+    for (size_t i = 0; i < channels.size(); ++i) {
+      const FanChannel& ch     = channels[i];
+      sample.duty[i]           = ch.fan_duty;
+      sample.rpms[i]           = snap.fans[i].rpms;
+      sample.commanded_duty[i] = manual() ? manual_duty : ch.auto_duty_val;
+    }
+    return sample;
+  }
+
+  TraceRecord to_trace_record() const {
+    const auto  now = std::chrono::steady_clock::now().time_since_epoch();
+    TraceRecord record;
+    record.timestamp_ns = std::chrono::nanoseconds(now).count();
+    record.cpu_temp     = cpu_temp;
+    record.gpu_temp     = gpu_temp;
+    record.fan_count    = static_cast<uint8_t>(channels.size());
+    record.manual       = manual();
+    record.commanded_duty.fill(-1);
+    for (size_t i = 0; i < channels.size(); ++i) {
+      record.duty[i]           = snap.fans[i].duty;
+      record.rpms[i]           = snap.fans[i].rpms;
+      record.commanded_duty[i] = channels[i].commanded_duty;
+    }
+    store_trace_raw(snap, layout.fans(), record);
+    return record;
+  }
+
+  /// Copies the last sample and the counters into \p m for the exporter.
+  void store_metrics(Metrics& m) const {
+    const EcWaitStats&    waits = ec_wait_stats();
+    const EcBackendStats& ec    = backend.stats();
+    m.cpu_temp = cpu_temp;
+    m.gpu_temp = gpu_temp;
+    for (size_t i = 0; i < channels.size(); ++i) {
+      m.fans[i].duty          = snap.fans[i].duty;
+      m.fans[i].rpms          = snap.fans[i].rpms;
+      m.fans[i].rpms_filtered = channels[i].monitor.filtered();
+      m.fans[i].stalls        = channels[i].monitor.stalls();
+    }
+    m.wait_timeouts  = waits.ibf.timeouts + waits.obf.timeouts;
+    m.transactions   = ec.transactions;
+    m.ec_errors      = ec.errors;
+    m.short_reads    = ec.short_reads;
+    m.writes_issued  = writes.issued;
+    m.writes_skipped = writes.skipped;
+    m.overrides      = writes.overrides;
+    m.ec_latency     = ec.latency;
+    m.ec_lock_wait   = ec.lock_wait;
+  }
+
+  EcBackend&                                            backend;
+  FanCurve                                              curve;
+  std::array<FanChannel, Profile.layout.fans().size()> channels;
+  EcSnapshot                                            snap;
+  int32_t        cpu_temp = 0, gpu_temp = 0;
+  double         cpu_input = 0.0, gpu_input = 0.0;
+  int32_t        manual_duty = -1;
+  DutyWriteStats writes;
+  bool           stall_guard = false;
+
+  std::optional<std::chrono::steady_clock::time_point> sleeping_since;
+
+  std::optional<HwmonSensors> hwmon;
+  FusionParams                fusion;
+
+  std::optional<FeedForward> feed_forward;
+  LoadSensor                 load_sensor;
+  int32_t                    duty_floor = 0;
+};
+} // namespace clevo
+
+#endif // CLEVO_WORKER_H